@@ -18,12 +18,29 @@
 */
 
 #include "ForceComputer.h"
+#include <util/atomic.h>
 
 
 ///////////////// RUNNING-EFFECTS TABLE HANDLING ////////////////
 
+//Bit number of the lowest zero bit, 8 when there is none
+static inline uint8_t lowestClearBit(uint8_t bits)
+{
+	if (bits == 0xFF) return 8;
+	return __builtin_ctz((uint8_t) ~bits);
+}
+
 void ForceComputer::createEffect(CreateNewEffectReport_t* newEffectReport)
 {
+	//Pending results wait for the host to read them. When it never did, the oldest is dropped and its
+	//block released: the host was never told that index, so it would stay allocated until Block Free 255
+	if ((uint8_t) (blockLoadHead - blockLoadTail) >= BLOCK_LOAD_QUEUE_LENGTH)
+	{
+		BlockLoadReport_t& dropped = blockLoadQueue[blockLoadTail & (BLOCK_LOAD_QUEUE_LENGTH - 1)];
+		if (dropped.loadStatus == 1) releaseSlot(dropped.effectBlockIndex);
+		blockLoadTail++;
+	}
+
 	blockLoadReport.reportId = 6;
 	blockLoadReport.effectBlockIndex = getNextFreeEffect();
 
@@ -31,128 +48,215 @@ void ForceComputer::createEffect(CreateNewEffectReport_t* newEffectReport)
 	{
 		blockLoadReport.loadStatus = 2;
 	}
-	else //Effect can be added
+	else //Effect can be added, the force loop resets the slot before applying its next report
 	{
 		blockLoadReport.loadStatus = 1;
+	}
+	blockLoadReport.ramPoolAvailable = MEMORY_SIZE - usedCount * EFFECT_SIZE;
+	memcpy(&blockLoadQueue[blockLoadHead & (BLOCK_LOAD_QUEUE_LENGTH - 1)], (void*) &blockLoadReport, sizeof(BlockLoadReport_t));
+	blockLoadHead++;
+}
 
-		volatile Effect_t* effect = &effectTable[blockLoadReport.effectBlockIndex];
-
-		memset((void*)effect, 0, sizeof(Effect_t));
-		effect->state = 0x01; //Memory allocated successfully
-		blockLoadReport.ramPoolAvailable -= EFFECT_SIZE;
+void ForceComputer::popBlockLoad(BlockLoadReport_t* report)
+{
+	if (blockLoadHead == blockLoadTail) //No effect creation to answer
+	{
+		report->reportId = 6;
+		report->effectBlockIndex = 0;
+		report->loadStatus = 3; //Error
+		report->ramPoolAvailable = blockLoadReport.ramPoolAvailable;
+		return;
 	}
+	*report = blockLoadQueue[blockLoadTail & (BLOCK_LOAD_QUEUE_LENGTH - 1)];
+	blockLoadTail++;
 }
 
+//Constant time: first byte with a free bit from fullBytes, then the free bit inside it
 uint8_t ForceComputer::getNextFreeEffect()
 {
-	if (nextFreeEffect == MAX_EFFECT_NUMBER)
+	uint8_t byte = lowestClearBit(fullBytes);
+	if (byte >= EFFECT_BITMAP_SIZE)
 		return 0;
 
-	//Allocate next free effect
-	uint8_t index = nextFreeEffect;
-	effectTable[index].state = 0x01;
+	uint8_t bit = lowestClearBit(usedSlots[byte]);
+	uint8_t index = byte * 8 + bit + 1;
+	if (index > MAX_EFFECT_NUMBER) //Only the padding bits of the last byte are left
+		return 0;
 
-	//Update nextFreeEffect by finding the new one
-	while (effectTable[nextFreeEffect].state != 0)
-	{
-		if (nextFreeEffect >= MAX_EFFECT_NUMBER)
-			break;
-		nextFreeEffect++;
-	}
+	uint8_t mask = 1 << bit;
+	usedSlots[byte] |= mask;
+	stagedSlots[byte] |= mask;
+	if (usedSlots[byte] == 0xFF)
+		fullBytes |= 1 << byte;
+	usedCount++;
 
 	return index;
 }
 
+//Resets the slots createEffect handed out, so only the force loop ever writes effectTable
+void ForceComputer::commitCreatedEffects()
+{
+	for (uint8_t byte = 0 ; byte < EFFECT_BITMAP_SIZE ; byte++)
+	{
+		if (stagedSlots[byte] == 0) continue;
+
+		uint8_t staged;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			staged = stagedSlots[byte];
+			stagedSlots[byte] = 0;
+		}
+
+		while (staged)
+		{
+			uint8_t index = byte * 8 + __builtin_ctz(staged) + 1;
+			staged &= staged - 1;
+			removePlaying(index);
+			memset(&effectTable[index - 1], 0, sizeof(Effect_t));
+			effectTable[index - 1].state = 0x01; //Memory allocated successfully
+		}
+	}
+}
+
 void ForceComputer::startEffect(uint8_t index)
 {
-	if (index > MAX_EFFECT_NUMBER) return;
-	effectTable[index].state = 0x02; //Effect playing
-	effectTable[index].elapsedTime = 0;
-	effectTable[index].startTime = (uint64_t) millis();
+	if (index == 0 || index > MAX_EFFECT_NUMBER) return;
+	Effect_t& effect = effectTable[index - 1];
+	if (!(effect.state & 0x02))
+		playingEffects[playingCount++] = index;
+	effect.state |= 0x02; //Effect playing
+	effect.startTime = clock();
 }
 
 void ForceComputer::stopEffect(uint8_t index)
 {
-	if (index > MAX_EFFECT_NUMBER) return;
-	effectTable[index].state &= ~0x02; //Effect not playing
-	blockLoadReport.ramPoolAvailable += EFFECT_SIZE;
+	if (index == 0 || index > MAX_EFFECT_NUMBER) return;
+	removePlaying(index);
+}
+
+//Drops an effect from the playing list, order of the list is not kept
+void ForceComputer::removePlaying(uint8_t index)
+{
+	if (!(effectTable[index - 1].state & 0x02)) return;
+	effectTable[index - 1].state &= ~0x02; //Effect not playing
+
+	for (uint8_t n = 0 ; n < playingCount ; n++)
+	{
+		if (playingEffects[n] == index)
+		{
+			playingEffects[n] = playingEffects[--playingCount];
+			break;
+		}
+	}
 }
 
 void ForceComputer::stopAll()
 {
-	for (uint8_t i = 0 ; i < MAX_EFFECT_NUMBER + 1 ; i++)
-		stopEffect(i);
+	while (playingCount > 0)
+		removePlaying(playingEffects[0]);
 }
 
 void ForceComputer::freeEffect(uint8_t index)
 {
-	if (index > MAX_EFFECT_NUMBER) return;
-	effectTable[index].state = 0;
-	if (index < nextFreeEffect)
-		nextFreeEffect = index; //Update nextFreeEffect
+	if (index == 0 || index > MAX_EFFECT_NUMBER) return;
+	removePlaying(index);
+	effectTable[index - 1].state = 0;
+	releaseSlot(index);
+}
+
+//Bitmap side of freeing a block, also called from createEffect for a result the host never read
+void ForceComputer::releaseSlot(uint8_t index)
+{
+	uint8_t byte = (index - 1) >> 3;
+	uint8_t mask = 1 << ((index - 1) & 7);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if (usedSlots[byte] & mask)
+		{
+			usedSlots[byte] &= ~mask;
+			stagedSlots[byte] &= ~mask;
+			fullBytes &= ~(1 << byte);
+			usedCount--;
+			blockLoadReport.ramPoolAvailable = MEMORY_SIZE - usedCount * EFFECT_SIZE;
+		}
+	}
 }
 
 void ForceComputer::freeAll(void)
 {
-	nextFreeEffect = 1;
-	memset((void*)& effectTable, 0, sizeof(effectTable));
-	blockLoadReport.ramPoolAvailable = MEMORY_SIZE;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		memset((void*) usedSlots, 0, sizeof(usedSlots));
+		memset((void*) stagedSlots, 0, sizeof(stagedSlots));
+		fullBytes = 0;
+		usedCount = 0;
+		blockLoadReport.ramPoolAvailable = MEMORY_SIZE;
+		blockLoadTail = blockLoadHead; //Unread results name blocks that are free now
+	}
+	playingCount = 0;
+	memset(&effectTable, 0, sizeof(effectTable));
 }
 
 
 
 ///////////////// FORCE REGISTERING FROM MAIN REPORT ////////////////
 
-void ForceComputer::SetEffect(SetEffectReport_t* report) //Effect (1)
+void ForceComputer::SetEffect(SetEffectReport_t* report, Effect_t* effect) //Effect (1)
 {
-	volatile Effect_t* effect = &effectTable[report->effectBlockIndex];
-
 	effect->duration = report->duration;
-	effect->directionX = report->directionX;
-	effect->directionY = report->directionY;
 	effect->effectType = report->effectType;
 	effect->gain = report->gain;
-	effect->enableAxis = report->enableAxis;
+	CompileRamp(effect);
+	CompileMix(effect);
 }
 
-void ForceComputer::SetEnvelope(SetEnvelopeReport_t* report, volatile Effect_t* effect) //Enveloppe (2)
+void ForceComputer::SetEnvelope(SetEnvelopeReport_t* report, Effect_t* effect) //Enveloppe (2)
 {
-	effect->attackLevel = report->attackLevel;
-	effect->fadeLevel = report->fadeLevel;
-	effect->attackTime = report->attackTime;
-	effect->fadeTime = report->fadeTime;
+	if ((effect->effectType >= 8 && effect->effectType <= 11) || (effect->state & 0x08))
+		return; //Conditions have no envelope, the same bytes hold their parameters
+	Envelope_t& envelope = effect->periodic.envelope;
+	envelope.attackLevel = clampForce(report->attackLevel);
+	envelope.fadeLevel = clampForce(report->fadeLevel);
+	envelope.attackTime = (report->attackTime > 0xFFFF) ? 0xFFFF : report->attackTime;
+	envelope.fadeTime = (report->fadeTime > 0xFFFF) ? 0xFFFF : report->fadeTime;
+	if (effect->effectType == 2) CompileRamp(effect);
+	else compileEnvelope(envelope, abs(effect->periodic.magnitude));
 }
 
-void ForceComputer::SetCondition(SetConditionReport_t* report, volatile Effect_t* effect) //Condition (3)
+void ForceComputer::SetCondition(SetConditionReport_t* report, Effect_t* effect) //Condition (3)
 {
 	uint8_t axis = report->parameterBlockOffset;
+	if (axis > 1) return;
 
-    effect->conditions[axis].cpOffset = report->cpOffset;
-    effect->conditions[axis].positiveCoefficient = report->positiveCoefficient;
-    effect->conditions[axis].negativeCoefficient = report->negativeCoefficient;
-    effect->conditions[axis].positiveSaturation = report->positiveSaturation;
-    effect->conditions[axis].negativeSaturation = report->negativeSaturation;
-    effect->conditions[axis].deadBand = report->deadBand;
-	effect->conditionBlocksCount++;
+	effect->condition.axes[axis] = compileCondition(report->cpOffset, report->deadBand,
+		report->positiveCoefficient, report->negativeCoefficient,
+		report->positiveSaturation, report->negativeSaturation);
+	effect->state |= 0x08; //Condition parameters in the union
+	if (axis == 1) effect->state |= 0x04; //Each axis has its own condition
 }
 
-void ForceComputer::SetPeriodic(SetPeriodicReport_t* report, volatile Effect_t* effect) //Periodic (4)
+void ForceComputer::SetPeriodic(SetPeriodicReport_t* report, Effect_t* effect) //Periodic (4)
 {
-	effect->magnitude = report->magnitude;
-	effect->offset = report->offset;
-	effect->phase = report->phase;
-	effect->period = report->period;
+	PeriodicParams_t& periodic = effect->periodic;
+	periodic.magnitude = clampForce(report->magnitude);
+	periodic.offset = clampInt16((int32_t) report->offset * 2);
+	periodic.phase = (uint32_t) phaseFromCentidegrees(report->phase) << 16;
+	periodic.phaseStep = phaseStep((report->period > 0xFFFF) ? 0xFFFF : report->period);
+	compileEnvelope(periodic.envelope, periodic.magnitude);
 }
 
-void ForceComputer::SetConstantForce(SetConstantForceReport_t* report, volatile Effect_t* effect) //Constant (5)
+void ForceComputer::SetConstantForce(SetConstantForceReport_t* report, Effect_t* effect) //Constant (5)
 {
-	effect->magnitude = report->magnitude;
+	effect->periodic.magnitude = clampForce(report->magnitude);
+	compileEnvelope(effect->periodic.envelope, abs(effect->periodic.magnitude));
 }
 
-void ForceComputer::SetRampForce(SetRampForceReport_t* report, volatile Effect_t* effect) //Ramp (6)
+void ForceComputer::SetRampForce(SetRampForceReport_t* report, Effect_t* effect) //Ramp (6)
 {
-	effect->startMagnitude = report->startMagnitude;
-	effect->endMagnitude = report->endMagnitude;
+	effect->ramp.startMagnitude = clampForce(report->startMagnitude);
+	effect->ramp.endMagnitude = clampForce(report->endMagnitude);
+	CompileRamp(effect);
 }
 
 void ForceComputer::SetCustomForceReport(SetCustomForcereportReport_t* report) //Customreport (7)
@@ -165,20 +269,24 @@ void ForceComputer::SetDownloadForceSample(SetDownloadForceSampleReport_t* repor
 
 void ForceComputer::EffectOperation(EffectOperationReport_t* report) //EffectOperation (10)
 {
+	uint8_t index = report->effectBlockIndex;
+	if (index == 0 || index > MAX_EFFECT_NUMBER) return;
+
 	switch (report->operation)
 	{
 		case 1: //Start effect
 			//Looped execution
-			if (report->loopCount > 0) effectTable[report->effectBlockIndex].duration *= report->loopCount;
-			if (report->loopCount == 0xFF) effectTable[report->effectBlockIndex].duration = 0x7FFF;
-			startEffect(report->effectBlockIndex);
+			if (report->loopCount > 0) effectTable[index - 1].duration *= report->loopCount;
+			if (report->loopCount == 0xFF) effectTable[index - 1].duration = INFINITE_DURATION;
+			if (report->loopCount > 0) CompileRamp(&effectTable[index - 1]);
+			startEffect(index);
 			break;
 		case 2: //Start with reset
 			stopAll();
-			startEffect(report->effectBlockIndex);
+			startEffect(index);
 			break;
 		case 3: //Stop effect
-			stopEffect(report->effectBlockIndex);
+			stopEffect(index);
 			break;
 		default:
 			break;
@@ -219,6 +327,10 @@ void ForceComputer::DeviceControl(DeviceControlReport_t* report) //DeviceControl
 void ForceComputer::DeviceGain(DeviceGainReport_t* report) //DeviceGain (13)
 {
 	deviceGain.gain = report->gain;
+	for (uint8_t i = 0 ; i < MAX_EFFECT_NUMBER ; i++)
+	{
+		if (effectTable[i].state & 0x01) CompileMix(&effectTable[i]);
+	}
 }
 
 void ForceComputer::SetCustomForce(SetCustomForceReport_t* report) //Custom (14)
@@ -229,176 +341,151 @@ void ForceComputer::SetCustomForce(SetCustomForceReport_t* report) //Custom (14)
 
 //////////////// FORCE COMPUTING ////////////////
 
-int32_t ForceComputer::ComputeEnvelope(volatile Effect_t& effect, int32_t value)
+//Level the ramp envelope leads to: the envelope scales the whole ramp, as it does a periodic magnitude
+static inline int16_t rampPeak(const RampParams_t& ramp)
 {
-	int32_t magnitude = (((int32_t) effect.magnitude) * effect.gain) / 255;
-	int32_t attackLevel = (((int32_t) effect.attackLevel) * effect.gain) / 255;
-	int32_t fadeLevel = (((int32_t) effect.fadeLevel) * effect.gain) / 255;
-	int32_t newValue = magnitude;
-	int32_t attackTime = effect.attackTime;
-	int32_t fadeTime = effect.fadeTime;
-	int32_t elapsedTime = effect.elapsedTime;
-	int32_t duration = effect.duration;
+	int16_t start = abs(ramp.startMagnitude);
+	int16_t end = abs(ramp.endMagnitude);
+	return (start > end) ? start : end;
+}
 
-	if (elapsedTime < attackTime)
-	{
-		newValue = (magnitude - attackLevel) * elapsedTime / attackTime;
-		newValue += attackLevel;
-	}
-	if (elapsedTime > (duration - fadeTime))
+//The ramp slope depends on the duration, which SetEffect and looped starts change
+void ForceComputer::CompileRamp(Effect_t* effect)
+{
+	if (effect->effectType != 2) return;
+	RampParams_t& ramp = effect->ramp;
+	ramp.slope = rampSlope(ramp.startMagnitude, ramp.endMagnitude, effect->duration);
+	compileEnvelope(ramp.envelope, rampPeak(ramp));
+}
+
+static uint16_t mixScale(uint8_t effectType)
+{
+	switch (effectType)
 	{
-		newValue = (magnitude - fadeLevel) * (duration - elapsedTime);
-		newValue /= fadeTime;
-		newValue += fadeLevel;
+		case 1: return MIX_SCALE(CONSTANT_GAIN);
+		case 2: return MIX_SCALE(RAMP_GAIN);
+		case 3: return MIX_SCALE(SQUARE_GAIN);
+		case 4: return MIX_SCALE(SINE_GAIN);
+		case 5: return MIX_SCALE(TRIANGLE_GAIN);
+		case 6: return MIX_SCALE(SAWTOOTHDOWN_GAIN);
+		case 7: return MIX_SCALE(SAWTOOTHUP_GAIN);
+		case 8: return MIX_SCALE(SPRING_GAIN);
+		case 9: return MIX_SCALE(DAMPER_GAIN);
+		case 10: return MIX_SCALE(INERTIA_GAIN);
+		case 11: return MIX_SCALE(FRICTION_GAIN);
+		case 12: return MIX_SCALE(CUSTOM_GAIN);
+		default: return 0;
 	}
-	newValue = newValue * value / magnitude;
+}
 
-	return newValue;
+//Everything between a kernel result and the output is one multiply, redone when a gain changes
+void ForceComputer::CompileMix(Effect_t* effect)
+{
+	uint32_t gains = gainProduct(effect->gain, deviceGain.gain);
+	effect->mix = (gains * mixScale(effect->effectType) + 0x8000) >> 16;
 }
 
-int32_t ForceComputer::ComputeConstantForce(volatile Effect_t& effect)
+//Magnitude of a constant or periodic effect once attack and fade are applied
+int32_t ForceComputer::ComputeEnvelope(Effect_t& effect, uint32_t elapsedTime)
 {
-	return ComputeEnvelope(effect, (int32_t)effect.magnitude);
-}
-
-int32_t ForceComputer::ComputeRampForce(volatile Effect_t& effect)
-{
-	int32_t tempforce = (int32_t)(effect.startMagnitude + effect.elapsedTime * 1.0 * (effect.endMagnitude - effect.startMagnitude) / effect.duration);
-	return ComputeEnvelope(effect, tempforce);
+	PeriodicParams_t& periodic = effect.periodic;
+	return envelopeAt(periodic.envelope, abs(periodic.magnitude), elapsedTime, effect.duration);
 }
-
-int32_t ForceComputer::ComputeSquareForce(volatile Effect_t& effect)
+
+int32_t ForceComputer::ComputeConstantForce(Effect_t& effect, uint32_t elapsedTime)
 {
-	int16_t offset = effect.offset * 2;
-	int16_t magnitude = effect.magnitude;
-	uint16_t phase = effect.phase;
-	uint16_t elapsedTime = effect.elapsedTime;
-	uint16_t period = effect.period;
-
-	int32_t maxMagnitude = offset + magnitude;
-	int32_t minMagnitude = offset - magnitude;
-	uint32_t phasetime = (phase * period) / 255;
-	uint32_t timeTemp = elapsedTime + phasetime;
-	uint32_t reminder = timeTemp % period;
-	int32_t tempforce;
-	if (reminder > (period / 2)) tempforce = minMagnitude;
-	else tempforce = maxMagnitude;
-	return ComputeEnvelope(effect, tempforce);
-}
-
-int32_t ForceComputer::ComputeSinForce(volatile Effect_t& effect)
-{
-	int16_t offset = effect.offset * 2;
-	int16_t magnitude = effect.magnitude;
-	uint16_t phase = effect.phase;
-	uint16_t timeTemp = effect.elapsedTime;
-	uint16_t period = effect.period;
-	float angle = 0.0;
-	if(period != 0)
-		angle = ((timeTemp * 1.0 / period) * 2 * PI + (phase / 36000.0));
-	float sine = sin(angle);
-	int32_t tempforce = (int32_t)(sine * magnitude);
-	tempforce += offset;
-	return ComputeEnvelope(effect, tempforce);
-}
-
-int32_t ForceComputer::ComputeTriangleForce(volatile Effect_t& effect)
-{
-	int16_t offset = effect.offset * 2;
-	int16_t magnitude = effect.magnitude;
-	uint16_t elapsedTime = effect.elapsedTime;
-	uint16_t phase = effect.phase;
-	uint16_t period = effect.period;
-	uint16_t periodF = effect.period;
-
-	int16_t maxMagnitude = offset + magnitude;
-	int16_t minMagnitude = offset - magnitude;
-	int32_t phasetime = (phase * period) / 255;
-	uint32_t timeTemp = elapsedTime + phasetime;
-	int32_t reminder = timeTemp % period;
-	int32_t slope = ((maxMagnitude - minMagnitude) * 2) / periodF;
-	int32_t tempforce = 0;
-	if (reminder > (periodF / 2)) tempforce = slope * (periodF - reminder);
-	else tempforce = slope * reminder;
-	tempforce += minMagnitude;
-	return ComputeEnvelope(effect, tempforce);
-}
-
-int32_t ForceComputer::ComputeSawtoothDownForce(volatile Effect_t& effect)
-{
-	int16_t offset = effect.offset * 2;
-	int16_t magnitude = effect.magnitude;
-	uint16_t elapsedTime = effect.elapsedTime;
-	uint16_t phase = effect.phase;
-	uint16_t period = effect.period;
-	uint16_t periodF = effect.period;
-
-	int16_t maxMagnitude = offset + magnitude;
-	int16_t minMagnitude = offset - magnitude;
-	int32_t phasetime = (phase * period) / 255;
-	uint32_t timeTemp = elapsedTime + phasetime;
-	int32_t reminder = timeTemp % period;
-	int32_t slope = (maxMagnitude - minMagnitude) / periodF;
-	int32_t tempforce = 0;
-	tempforce = slope * (period - reminder);
-	tempforce += minMagnitude;
-	return ComputeEnvelope(effect, tempforce);
-}
-
-int32_t ForceComputer::ComputeSawtoothUpForce(volatile Effect_t& effect)
-{
-	int16_t offset = effect.offset * 2;
-	int16_t magnitude = effect.magnitude;
-	uint16_t elapsedTime = effect.elapsedTime;
-	uint16_t phase = effect.phase;
-	uint16_t period = effect.period;
-	uint16_t periodF = effect.period;
-
-	int16_t maxMagnitude = offset + magnitude;
-	int16_t minMagnitude = offset - magnitude;
-	int32_t phasetime = (phase * period) / 255;
-	uint32_t timeTemp = elapsedTime + phasetime;
-	int32_t reminder = timeTemp % period;
-	int32_t slope = (maxMagnitude - minMagnitude) / periodF;
-	int32_t tempforce = 0;
-	tempforce = slope * reminder;
-	tempforce += minMagnitude;
-	return ComputeEnvelope(effect, tempforce);
-}
-
-int32_t ForceComputer::ComputeConditionForce(volatile Effect_t& effect, int16_t value, int16_t maxValue, uint8_t axis)
-{
-	float deadBand;
-	float cpOffset;
-	float positiveCoefficient;
-	float negativeCoefficient;
-	float positiveSaturation;
-	float negativeSaturation;
-
-    deadBand = effect.conditions[axis].deadBand;
-    cpOffset = effect.conditions[axis].cpOffset;
-    negativeCoefficient = effect.conditions[axis].negativeCoefficient;
-    negativeSaturation = effect.conditions[axis].negativeSaturation;
-    positiveSaturation = effect.conditions[axis].positiveSaturation;
-    positiveCoefficient = effect.conditions[axis].positiveCoefficient;
-
-	float normalizedValue = (float)value * 1.00 / maxValue;
-
-	float  tempForce = 0;
-	if (normalizedValue < (cpOffset - deadBand))
-	{
-		tempForce = (normalizedValue - (float)1.00*(cpOffset - deadBand)/10000) * negativeCoefficient;
-		tempForce = (tempForce < -negativeSaturation ? -negativeSaturation : tempForce);
-	}
-	else if (normalizedValue > (cpOffset + deadBand))
+	int32_t tempforce = ComputeEnvelope(effect, elapsedTime);
+	if (effect.periodic.magnitude < 0) tempforce = -tempforce;
+	return tempforce;
+}
+
+int32_t ForceComputer::ComputeRampForce(Effect_t& effect, uint32_t elapsedTime)
+{
+	RampParams_t& ramp = effect.ramp;
+	uint32_t end = timeUnits(effect.duration);
+	if (elapsedTime > end) elapsedTime = end; //Looped forever: hold the end
+	int32_t tempforce = ramp.startMagnitude + ((ramp.slope * (int32_t) elapsedTime) >> 16);
+
+	int32_t peak = rampPeak(ramp);
+	int32_t level = envelopeAt(ramp.envelope, peak, elapsedTime, effect.duration);
+	if (peak && level != peak) tempforce = tempforce * level / peak; //Only divides during attack and fade
+	return tempforce;
+}
+
+int32_t ForceComputer::ComputeSquareForce(Effect_t& effect, uint32_t elapsedTime)
+{
+	PeriodicParams_t& periodic = effect.periodic;
+	uint32_t phase = periodic.phase + elapsedTime * periodic.phaseStep;
+	int32_t magnitude = ComputeEnvelope(effect, elapsedTime);
+	int32_t tempforce = periodic.offset;
+	if (phase < 0x80000000UL) tempforce += magnitude; //High first half period
+	else tempforce -= magnitude;
+	return tempforce;
+}
+
+int32_t ForceComputer::ComputeSinForce(Effect_t& effect, uint32_t elapsedTime)
+{
+	PeriodicParams_t& periodic = effect.periodic;
+	uint32_t phase = periodic.phase + elapsedTime * periodic.phaseStep;
+	int32_t magnitude = ComputeEnvelope(effect, elapsedTime);
+	int32_t tempforce = periodic.offset + ((sineQ15(phase) * magnitude) >> 15);
+	return tempforce;
+}
+
+int32_t ForceComputer::ComputeTriangleForce(Effect_t& effect, uint32_t elapsedTime)
+{
+	PeriodicParams_t& periodic = effect.periodic;
+	uint32_t phase = periodic.phase + elapsedTime * periodic.phaseStep;
+	int32_t magnitude = ComputeEnvelope(effect, elapsedTime);
+	uint32_t position = phase >> 16; //Q16 of the period
+	uint32_t rise = (position < 0x8000) ? position : 0x10000 - position; //Q15 of the full swing
+	int32_t tempforce = periodic.offset - magnitude + ((magnitude * (int32_t) (rise << 1)) >> 15);
+	return tempforce;
+}
+
+int32_t ForceComputer::ComputeSawtoothDownForce(Effect_t& effect, uint32_t elapsedTime)
+{
+	PeriodicParams_t& periodic = effect.periodic;
+	uint32_t phase = periodic.phase + elapsedTime * periodic.phaseStep;
+	int32_t magnitude = ComputeEnvelope(effect, elapsedTime);
+	uint32_t position = 0x10000 - (phase >> 16); //Q16 of the full swing
+	int32_t tempforce = periodic.offset - magnitude + ((magnitude * (int32_t) position) >> 15);
+	return tempforce;
+}
+
+int32_t ForceComputer::ComputeSawtoothUpForce(Effect_t& effect, uint32_t elapsedTime)
+{
+	PeriodicParams_t& periodic = effect.periodic;
+	uint32_t phase = periodic.phase + elapsedTime * periodic.phaseStep;
+	int32_t magnitude = ComputeEnvelope(effect, elapsedTime);
+	uint32_t position = phase >> 16; //Q16 of the full swing
+	int32_t tempforce = periodic.offset - magnitude + ((magnitude * (int32_t) position) >> 15);
+	return tempforce;
+}
+
+int32_t ForceComputer::ComputeConditionForce(Effect_t& effect, int32_t deflection, uint8_t axis)
+{
+	return conditionForce(effect.condition.axes[axis], deflection);
+}
+
+//Sketch-supplied values are in -MAX..MAX of each type, the estimator already gives deflections
+void ForceComputer::readConditionInputs()
+{
+	if (motion.running())
 	{
-		tempForce = (normalizedValue - (float)1.00 * (cpOffset + deadBand) / 10000) * positiveCoefficient;
-		tempForce = (tempForce > positiveSaturation ? positiveSaturation : tempForce);
+		motion.readInputs(&conditionInputs);
+		return;
 	}
-	else return 0;
-	tempForce = -tempForce * effect.gain / 255;
 
-	return (int32_t)tempForce;
+	conditionInputs.spring = ((int32_t) springCurPos * CONDITION_SCALE(SPRING_MAX_POS)) >> 8;
+	conditionInputs.damper = ((int32_t) damperCurVel * CONDITION_SCALE(DAMPER_MAX_VEL)) >> 8;
+	conditionInputs.inertia = ((int32_t) abs(inertiaCurAcc) * CONDITION_SCALE(INERTIA_MAX_ACC)) >> 8;
+	conditionInputs.friction = ((int32_t) frictionCurPos * CONDITION_SCALE(FRICTION_MAX_POS)) >> 8;
+
+	//Inertia only pushes while decelerating, against the side the friction position is on
+	conditionInputs.inertiaSign = 0;
+	if (inertiaCurAcc < 0 && frictionCurPos < 0) conditionInputs.inertiaSign = 1;
+	else if (inertiaCurAcc < 0 && frictionCurPos > 0) conditionInputs.inertiaSign = -1;
 }
 
 
@@ -410,25 +497,34 @@ void ForceComputer::castReport(uint8_t* report, uint16_t len)
 {
 	uint8_t effectId = report[1];
 
+	commitCreatedEffects();
+
+	Effect_t* effect = NULL; //Only the parameter reports (1..6) address an effect block
+	if (report[0] <= 6)
+	{
+		if (effectId == 0 || effectId > MAX_EFFECT_NUMBER) return; //Not one of our effects
+		effect = &effectTable[effectId - 1];
+	}
+
 	switch (report[0])
 	{
 	case 1:
-		SetEffect((SetEffectReport_t*) report);
+		SetEffect((SetEffectReport_t*) report, effect);
 		break;
 	case 2:
-		SetEnvelope((SetEnvelopeReport_t*) report, &effectTable[effectId]);
+		SetEnvelope((SetEnvelopeReport_t*) report, effect);
 		break;
 	case 3:
-		SetCondition((SetConditionReport_t*) report, &effectTable[effectId]);
+		SetCondition((SetConditionReport_t*) report, effect);
 		break;
 	case 4:
-		SetPeriodic((SetPeriodicReport_t*) report, &effectTable[effectId]);
+		SetPeriodic((SetPeriodicReport_t*) report, effect);
 		break;
 	case 5:
-		SetConstantForce((SetConstantForceReport_t*) report, &effectTable[effectId]);
+		SetConstantForce((SetConstantForceReport_t*) report, effect);
 		break;
 	case 6:
-		SetRampForce((SetRampForceReport_t*) report, &effectTable[effectId]);
+		SetRampForce((SetRampForceReport_t*) report, effect);
 		break;
 	case 7:
 		SetCustomForceReport((SetCustomForcereportReport_t*) report);
@@ -456,75 +552,126 @@ void ForceComputer::castReport(uint8_t* report, uint16_t len)
 	}
 }
 
-void ForceComputer::ComputeFinalForces(int32_t* forces) {
-	forces[0] = 0;
-    forces[1] = 0;
-	for (int i = 0; i < MAX_EFFECT_NUMBER; i++)
+void ForceComputer::ComputeFinalForces(int32_t* forces, uint32_t now) {
+	RenderForces(forces, 1, now, 0);
+}
+
+//forces holds count x/y pairs, pair k being what ComputeFinalForces would give at start + k * samplePeriod
+void ForceComputer::RenderForces(int32_t* forces, uint16_t count, uint32_t start, uint32_t samplePeriod) {
+	memset(forces, 0, count * 2 * sizeof(int32_t));
+	readConditionInputs();
+	uint8_t n = 0;
+	while (n < playingCount && !devicePaused)
 	{
-		if ((effectTable[i].state == 0x02) && //Effect playing
-			((effectTable[i].elapsedTime <= effectTable[i].duration) ||
-			(effectTable[i].duration == 0x7FFF)) &&
-			!devicePaused)
+		uint8_t i = playingEffects[n];
+		Effect_t& effect = effectTable[i - 1];
+		uint32_t elapsedMicros = start - effect.startTime; //Wrap-safe for effects shorter than 71 minutes
+		uint16_t live = count; //Samples before the effect is over
+
+		if (effect.duration == INFINITE_DURATION)
 		{
-			for (int j = 0; j < 2; j++)
+			if (elapsedMicros >= 0x80000000UL) //Rebase endless effects long before elapsed time wraps
 			{
-				uint8_t axis;
-
-				if (effectTable[i].conditionBlocksCount > 1) axis = j;
-				else axis = 0;
-
-				switch (effectTable[i].effectType)
-				{
-					case 1: //Constant
-						forces[j] += ComputeConstantForce(effectTable[i]) * CONSTANT_GAIN;
-						break;
-					case 2: //Ramp
-						forces[j] += ComputeRampForce(effectTable[i]) * RAMP_GAIN;
-						break;
-					case 3: //Periodic_Square
-						forces[j] += ComputeSquareForce(effectTable[i]) * SQUARE_GAIN;
-						break;
-					case 4: //Periodic_Sine
-						forces[j] += ComputeSinForce(effectTable[i]) * SINE_GAIN;
-						break;
-					case 5: //Periodic_Triangle
-						forces[j] += ComputeTriangleForce(effectTable[i]) * TRIANGLE_GAIN;
-						break;
-					case 6: //Periodic_SawtoothDown
-						forces[j] += ComputeSawtoothDownForce(effectTable[i]) * SAWTOOTHDOWN_GAIN;
-						break;
-					case 7: //Periodic_SawtoothUp
-						forces[j] += ComputeSawtoothUpForce(effectTable[i]) * SAWTOOTHUP_GAIN;
-						break;
-					case 8: //Condition_Spring
-						forces[j] += ComputeConditionForce(effectTable[i], springCurPos, SPRING_MAX_POS, axis) * SPRING_GAIN;
-						break;
-					case 9: //Condition_Damper
-						forces[j] += ComputeConditionForce(effectTable[i], damperCurVel, DAMPER_MAX_VEL, axis) * DAMPER_GAIN;
-						break;
-					case 10: //Condition_Inertia
-						if (inertiaCurAcc < 0 && frictionCurPos < 0) {
-							forces[j] += ComputeConditionForce(effectTable[i], abs(inertiaCurAcc), INERTIA_MAX_ACC, axis) * INERTIA_GAIN;
-						}
-						else if (inertiaCurAcc < 0 && frictionCurPos > 0) {
-							forces[j] += -1 * ComputeConditionForce(effectTable[i], abs(inertiaCurAcc), INERTIA_MAX_ACC, axis) * INERTIA_GAIN;
-						}
-						break;
-					case 11: //Condition_Friction
-						forces[j] += ComputeConditionForce(effectTable[i], frictionCurPos, FRICTION_MAX_POS, axis) * FRICTION_GAIN;
-						break;
-					case 12: //Custom
-						break;
-				}
-
-                effectTable[i].elapsedTime = (uint64_t)millis() - effectTable[i].startTime;
-
+				effect.startTime += 0x40000000UL;
+				elapsedMicros -= 0x40000000UL;
+				if (effect.effectType >= 3 && effect.effectType <= 7)
+					effect.periodic.phase += (0x40000000UL >> TIME_UNIT_SHIFT) * effect.periodic.phaseStep;
 			}
 		}
+		else
+		{
+			uint32_t end = (uint32_t) effect.duration * 1000;
+			if (elapsedMicros > end) live = 0;
+			else if (samplePeriod > 0 && (end - elapsedMicros) / samplePeriod < count)
+				live = (end - elapsedMicros) / samplePeriod + 1;
+		}
+
+		if (live > 0) RenderEffect(effect, forces, live, elapsedMicros, samplePeriod);
+		if (live < count)
+		{
+			removePlaying(i); //Effect is over, the last playing one takes its place
+			continue;
+		}
+		n++;
+	}
+	for (uint16_t j = 0; j < count * 2; j++)
+	{
+#if FORCE_OUTPUT_DITHER
+		forces[j] = mixDitheredOutput(forces[j], ditherState);
+#else
+		forces[j] = mixOutput(forces[j]);
+#endif
+	}
+}
+
+//Time-based effects push the same force on both axes
+#define RENDER_TIMED(kernel) \
+	for (uint16_t k = 0 ; k < count ; k++, elapsedMicros += samplePeriod) \
+	{ \
+		int32_t force = kernel(effect, elapsedMicros >> TIME_UNIT_SHIFT) * mix; \
+		forces[2 * k] = saturatingAdd(forces[2 * k], force); \
+		forces[2 * k + 1] = saturatingAdd(forces[2 * k + 1], force); \
+	}
+
+//Adds count samples of one effect, dispatching on its type once for the whole block
+void ForceComputer::RenderEffect(Effect_t& effect, int32_t* forces, uint16_t count, uint32_t elapsedMicros, uint32_t samplePeriod)
+{
+	int32_t mix = effect.mix;
+	switch (effect.effectType)
+	{
+		case 1: //Constant
+			RENDER_TIMED(ComputeConstantForce);
+			return;
+		case 2: //Ramp
+			RENDER_TIMED(ComputeRampForce);
+			return;
+		case 3: //Periodic_Square
+			RENDER_TIMED(ComputeSquareForce);
+			return;
+		case 4: //Periodic_Sine
+			RENDER_TIMED(ComputeSinForce);
+			return;
+		case 5: //Periodic_Triangle
+			RENDER_TIMED(ComputeTriangleForce);
+			return;
+		case 6: //Periodic_SawtoothDown
+			RENDER_TIMED(ComputeSawtoothDownForce);
+			return;
+		case 7: //Periodic_SawtoothUp
+			RENDER_TIMED(ComputeSawtoothUpForce);
+			return;
+		case 12: //Custom
+			return;
+	}
+
+	//Conditions only depend on the inputs, which stay the same across the block
+	int32_t axisForces[2] = { 0, 0 };
+	for (uint8_t j = 0; j < 2; j++)
+	{
+		uint8_t axis;
+
+		if (effect.state & 0x04) axis = j;
+		else axis = 0;
+
+		switch (effect.effectType)
+		{
+			case 8: //Condition_Spring
+				axisForces[j] = ComputeConditionForce(effect, conditionInputs.spring, axis) * mix;
+				break;
+			case 9: //Condition_Damper
+				axisForces[j] = ComputeConditionForce(effect, conditionInputs.damper, axis) * mix;
+				break;
+			case 10: //Condition_Inertia
+				axisForces[j] = conditionInputs.inertiaSign * ComputeConditionForce(effect, conditionInputs.inertia, axis) * mix;
+				break;
+			case 11: //Condition_Friction
+				axisForces[j] = ComputeConditionForce(effect, conditionInputs.friction, axis) * mix;
+				break;
+		}
 	}
-	for (int j = 0; j < 2; j++)
+	for (uint16_t k = 0 ; k < count ; k++)
 	{
-		forces[j] = (int32_t)((float)1.0 * forces[j] * TOTAL_GAIN / 10000);
-		forces[j] = map(forces[j], -10000, 10000, -255, 255);
+		forces[2 * k] = saturatingAdd(forces[2 * k], axisForces[0]);
+		forces[2 * k + 1] = saturatingAdd(forces[2 * k + 1], axisForces[1]);
 	}
 }
@@ -20,11 +20,25 @@
 #ifndef FORCECOMPUTER_h
 #define FORCECOMPUTER_h
 #include <Arduino.h>
+#include "ForceKernels.h"
+#include "MotionEstimator.h"
 
-#define MAX_EFFECT_NUMBER 14
+#ifndef MAX_EFFECT_NUMBER
+//Effect pool size, the PID descriptor allows up to 40. At 39 bytes per effect on AVR, 24 take 936 bytes,
+//within the 945 of the original 14-effect table, raise it on boards with RAM to spare
+#define MAX_EFFECT_NUMBER 24
+#endif
+#if MAX_EFFECT_NUMBER > 40
+#error "MAX_EFFECT_NUMBER is limited to 40 by the Effect Block Index logical maximum"
+#endif
 #define EFFECT_SIZE sizeof(Effect_t)
 #define MEMORY_SIZE (uint16_t)(MAX_EFFECT_NUMBER*EFFECT_SIZE)
 
+#ifndef BLOCK_LOAD_QUEUE_LENGTH
+#define BLOCK_LOAD_QUEUE_LENGTH 4 //Power of two, Block Load results waiting for the host to read them
+#endif
+#define EFFECT_BITMAP_SIZE ((MAX_EFFECT_NUMBER + 7) / 8) //One bit per slot, index 1 is bit 0 of byte 0
+
 #define TOTAL_GAIN 100
 #define CONSTANT_GAIN 100
 #define RAMP_GAIN 100
@@ -44,46 +58,57 @@
 #define FRICTION_GAIN 100
 #define FRICTION_MAX_POS 255
 
+//Q(MIX_SHIFT) factor from a type gain in percent to the output scale, folded at compile time
+#define MIX_SCALE(typeGain) ((uint16_t) ((typeGain) * TOTAL_GAIN * (double) OUTPUT_MAX * (1UL << MIX_SHIFT) / (100.0 * 100.0 * FORCE_FULL_SCALE) + 0.5))
+
+
+//////////////// EFFECT STORAGE ////////////////
 
-//////////////// ABSTRACT REPORTS ////////////////
+//The envelope comes first in both, so a Set Envelope report sent before Set Effect lands in the same bytes
+typedef struct //Constant (magnitude only) and periodic effects
+{
+	Envelope_t envelope;
+	int16_t magnitude; //Signed for constant forces
+	int16_t offset; //Periodic center, doubled
+	uint32_t phase; //Q32 turns at the start
+	uint32_t phaseStep; //Q32 turns per time unit, from the period
+} PeriodicParams_t;
 
 typedef struct
 {
-	int16_t cpOffset;
-	int16_t positiveCoefficient;
-	int16_t negativeCoefficient;
-	int16_t positiveSaturation;
-	int16_t negativeSaturation;
-	uint16_t deadBand;
-} Condition_t;
+	Envelope_t envelope; //Scales the ramp, against the larger of the two magnitudes
+	int16_t startMagnitude;
+	int16_t endMagnitude;
+	int32_t slope; //Q16 per time unit, from the duration
+} RampParams_t;
 
 typedef struct
 {
-	volatile uint8_t state;
+	ConditionKernel_t axes[2];
+} ConditionParams_t;
+
+//Only what the force loop needs, type-specific parameters share the same bytes
+typedef struct
+{
+	uint8_t state; //0x01 allocated, 0x02 playing, 0x04 conditions on both axes, 0x08 condition parameters set
 	uint8_t effectType;
-	int16_t offset;
 	uint8_t gain;
-	int16_t attackLevel;
-	int16_t fadeLevel;
-	uint16_t fadeTime;
-	uint16_t attackTime;
-	int16_t magnitude;
-	uint8_t enableAxis;
-	uint8_t directionX;
-	uint8_t directionY;
-	uint8_t conditionBlocksCount;
-	Condition_t conditions[2];
-	uint16_t phase;
-	int16_t startMagnitude;
-	int16_t endMagnitude;
-	uint16_t period;
+	uint16_t mix; //Effect, type, device and total gains with the output scale, see MIX_SCALE
 	uint16_t duration;
-    uint16_t elapsedTime;
-	uint64_t startTime;
+	uint32_t startTime; //Force clock in microseconds, elapsed time is computed wrap-safe from it
+	union
+	{
+		PeriodicParams_t periodic;
+		RampParams_t ramp;
+		ConditionParams_t condition;
+	};
 } Effect_t;
 
 
 
+//Reports below are USB wire formats: keep them byte-packed on every target
+#pragma pack(push, 1)
+
 ///////////////// MEMORY HANDLING REPORTS ////////////////
 
 typedef struct
@@ -225,6 +250,8 @@ typedef struct //Custom (14)
 	uint16_t samplePeriod;
 } SetCustomForceReport_t;
 
+#pragma pack(pop)
+
 
 
 //////////////// MAIN CLASS ///////////////
@@ -233,63 +260,91 @@ class ForceComputer
 {
 public:
 
-	volatile uint8_t nextFreeEffect = 1; //Id of empty effect slot
-	volatile Effect_t effectTable[MAX_EFFECT_NUMBER + 1]; //Running-effects storage
+	Effect_t effectTable[MAX_EFFECT_NUMBER]; //Running-effects storage for indexes 1..MAX_EFFECT_NUMBER, only touched by the force loop
 
 	//Memory/Device handling
 	volatile uint8_t devicePaused = 0;
-	volatile BlockLoadReport_t blockLoadReport;
+	volatile BlockLoadReport_t blockLoadReport = { 0, 0, 0, MEMORY_SIZE };
 	volatile PoolReport_t poolReport;
 	void createEffect(CreateNewEffectReport_t* newEffectReport);
+	void popBlockLoad(BlockLoadReport_t* report); //Oldest unanswered Create New Effect result
 
-	//Condition force param
+	//Condition force param, used while the motion estimator is not running
 	int16_t springCurPos = 100;
 	int16_t damperCurVel = 100;
 	int16_t inertiaCurAcc = 100;
 	int16_t frictionCurPos = 100;
+	MotionEstimator motion; //Condition inputs from encoder counts once begun
+
+	//Time source in microseconds, a host build can swap in a simulated clock
+	uint32_t (*clock)(void) = micros;
 
 	//Interfacing methods
 	void castReport(uint8_t* report, uint16_t len);
-	void ComputeFinalForces(int32_t* forces);
+	void ComputeFinalForces(int32_t* forces) { ComputeFinalForces(forces, clock()); }
+	void ComputeFinalForces(int32_t* forces, uint32_t now); //now is one clock snapshot for the whole tick
+	void RenderForces(int32_t* forces, uint16_t count, uint32_t start, uint32_t samplePeriod); //count samples, samplePeriod microseconds apart
 
 private:
 
+	//Slot allocation, shared with createEffect in the USB control ISR
+	volatile uint8_t usedSlots[EFFECT_BITMAP_SIZE] = { 0 };
+	volatile uint8_t stagedSlots[EFFECT_BITMAP_SIZE] = { 0 }; //Handed out by createEffect, not yet reset by the force loop
+	volatile uint8_t fullBytes = 0; //Bit n set while usedSlots[n] is 0xFF
+	volatile uint8_t usedCount = 0;
+	void commitCreatedEffects();
+	void releaseSlot(uint8_t index);
+
+	//Block Load results, queued by createEffect and read by popBlockLoad, both from the control request handler
+	BlockLoadReport_t blockLoadQueue[BLOCK_LOAD_QUEUE_LENGTH];
+	uint8_t blockLoadHead = 0;
+	uint8_t blockLoadTail = 0;
+
 	//Running-effects table handling
+	uint8_t playingEffects[MAX_EFFECT_NUMBER]; //Packed indexes of the playing effects
+	uint8_t playingCount = 0;
+	uint32_t ditherState = 0x9E3779B9UL; //Output dither generator, see FORCE_OUTPUT_DITHER
+	ConditionInputs_t conditionInputs; //Read once per RenderForces call
+	void readConditionInputs();
 	uint8_t getNextFreeEffect();
 	void startEffect(uint8_t index);
 	void stopEffect(uint8_t index);
 	void stopAll();
+	void removePlaying(uint8_t index);
 	void freeEffect(uint8_t index);
 	void freeAll();
 
 	//Memory/Device handling
-	volatile DeviceGainReport_t deviceGain;
+	volatile DeviceGainReport_t deviceGain = { 13, 255 };
 	void EffectOperation(EffectOperationReport_t* report);
 	void BlockFree(BlockFreeReport_t* report);
 	void DeviceControl(DeviceControlReport_t* report);
 	void DeviceGain(DeviceGainReport_t* report);
 
 	//Forces registering
-	void SetEffect(SetEffectReport_t* report);
-	void SetEnvelope(SetEnvelopeReport_t* report, volatile Effect_t* effect);
-	void SetConstantForce(SetConstantForceReport_t* report, volatile Effect_t* effect);
-	void SetRampForce(SetRampForceReport_t* report, volatile Effect_t* effect);
-	void SetPeriodic(SetPeriodicReport_t* report, volatile Effect_t* effect);
-	void SetCondition(SetConditionReport_t* report, volatile Effect_t* effect);
+	void SetEffect(SetEffectReport_t* report, Effect_t* effect);
+	void SetEnvelope(SetEnvelopeReport_t* report, Effect_t* effect);
+	void SetConstantForce(SetConstantForceReport_t* report, Effect_t* effect);
+	void SetRampForce(SetRampForceReport_t* report, Effect_t* effect);
+	void SetPeriodic(SetPeriodicReport_t* report, Effect_t* effect);
+	void SetCondition(SetConditionReport_t* report, Effect_t* effect);
 	void SetCustomForce(SetCustomForceReport_t* report);
 	void SetCustomForceReport(SetCustomForcereportReport_t* report);
 	void SetDownloadForceSample(SetDownloadForceSampleReport_t* report);
 
-	//Forces computing
-	int32_t ComputeEnvelope(volatile Effect_t& effect, int32_t value);
-	int32_t ComputeConstantForce(volatile Effect_t& effect);
-	int32_t ComputeRampForce(volatile Effect_t& effect);
-	int32_t ComputeSquareForce(volatile Effect_t& effect);
-	int32_t ComputeSinForce(volatile Effect_t& effect);
-	int32_t ComputeTriangleForce(volatile Effect_t& effect);
-	int32_t ComputeSawtoothDownForce(volatile Effect_t& effect);
-	int32_t ComputeSawtoothUpForce(volatile Effect_t& effect);
-	int32_t ComputeConditionForce(volatile Effect_t& effect, int16_t value, int16_t maxValue, uint8_t axis);
+	//Forces computing, elapsedTime is in time units (see TIME_UNIT_SHIFT)
+	void CompileRamp(Effect_t* effect);
+	void CompileMix(Effect_t* effect);
+	int32_t ComputeEnvelope(Effect_t& effect, uint32_t elapsedTime);
+	int32_t ComputeConstantForce(Effect_t& effect, uint32_t elapsedTime);
+	int32_t ComputeRampForce(Effect_t& effect, uint32_t elapsedTime);
+	int32_t ComputeSquareForce(Effect_t& effect, uint32_t elapsedTime);
+	int32_t ComputeSinForce(Effect_t& effect, uint32_t elapsedTime);
+	int32_t ComputeTriangleForce(Effect_t& effect, uint32_t elapsedTime);
+	int32_t ComputeSawtoothDownForce(Effect_t& effect, uint32_t elapsedTime);
+	int32_t ComputeSawtoothUpForce(Effect_t& effect, uint32_t elapsedTime);
+	int32_t ComputeConditionForce(Effect_t& effect, int32_t deflection, uint8_t axis);
+	void RenderEffect(Effect_t& effect, int32_t* forces, uint16_t count, uint32_t elapsedMicros, uint32_t samplePeriod);
 };
 
 #endif
@@ -0,0 +1,308 @@
+/*
+  ForceKernels.h - Integer force kernels used by ForceComputer on every tick
+
+  Copyright (c) 2020, Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FORCEKERNELS_h
+#define FORCEKERNELS_h
+#include <Arduino.h>
+
+//PID magnitudes, offsets, coefficients and saturations are all expressed in 1/10000
+#define FORCE_FULL_SCALE 10000L
+
+//Q8 factor turning a condition input in -maxValue..maxValue into 1/10000 deflection units
+#define CONDITION_SCALE(maxValue) ((int32_t) ((FORCE_FULL_SCALE << 8) / (maxValue)))
+
+//Kernels run on 16 us time units: smooth at kHz update rates, and a Q16 slope times
+//any elapsed time up to a 65 s envelope still fits in 32 bits
+#define TIME_UNIT_SHIFT 4
+
+//PID times are in milliseconds
+static inline uint32_t timeUnits(uint16_t milliseconds)
+{
+	return ((uint32_t) milliseconds * 125) >> 1; //* 1000 / 16
+}
+
+
+static inline int16_t clampInt16(int32_t value)
+{
+	if (value > 32767) return 32767;
+	if (value < -32767) return -32767;
+	return (int16_t) value;
+}
+
+static inline int16_t clampForce(int32_t value)
+{
+	if (value > FORCE_FULL_SCALE) return FORCE_FULL_SCALE;
+	if (value < -FORCE_FULL_SCALE) return -FORCE_FULL_SCALE;
+	return (int16_t) value;
+}
+
+//value * factor >> 16, exact, from 16x16 -> 32 multiplies: the AVR has no 64-bit product, and the
+//software one costs hundreds of cycles. The result must fit in 32 bits.
+static inline int32_t mulQ16(int32_t value, uint32_t factor)
+{
+	int16_t high = value >> 16;
+	uint16_t low = value;
+	uint16_t factorLow = factor;
+	int32_t product = (int32_t) high * factorLow + (int32_t) (((uint32_t) low * factorLow) >> 16);
+	if (factor >> 16) product += value * (int32_t) (factor >> 16);
+	return product;
+}
+
+
+//////////////// CONDITION KERNEL ////////////////
+
+//Per-axis condition parameters, compiled once when the condition changes
+typedef struct
+{
+	int16_t lowerBound; //cpOffset - deadBand
+	int16_t upperBound; //cpOffset + deadBand
+	int16_t negativeCoefficient; //Q15
+	int16_t positiveCoefficient; //Q15
+	int16_t negativeSaturation;
+	int16_t positiveSaturation;
+} ConditionKernel_t;
+
+//Coefficient in 1/10000 to Q15
+static inline int16_t conditionCoefficientQ15(int16_t coefficient)
+{
+	return clampInt16(((int32_t) coefficient * 2048) / 625); //* 32768 / 10000
+}
+
+static inline ConditionKernel_t compileCondition(int16_t cpOffset, uint16_t deadBand,
+	int16_t positiveCoefficient, int16_t negativeCoefficient,
+	uint16_t positiveSaturation, uint16_t negativeSaturation)
+{
+	ConditionKernel_t kernel;
+	kernel.lowerBound = clampInt16((int32_t) cpOffset - deadBand);
+	kernel.upperBound = clampInt16((int32_t) cpOffset + deadBand);
+	kernel.negativeCoefficient = conditionCoefficientQ15(negativeCoefficient);
+	kernel.positiveCoefficient = conditionCoefficientQ15(positiveCoefficient);
+	kernel.negativeSaturation = clampForce(negativeSaturation);
+	kernel.positiveSaturation = clampForce(positiveSaturation);
+	return kernel;
+}
+
+//Deflection in 1/10000 (see CONDITION_SCALE), result in 1/10000 opposing the deflection.
+//Deflections further than 3.2 full scales past a bound are clamped to keep the product in 32 bits.
+static inline int32_t conditionForce(const ConditionKernel_t& kernel, int32_t deflection)
+{
+	int32_t force;
+	if (deflection < kernel.lowerBound)
+	{
+		force = ((int32_t) clampInt16(deflection - kernel.lowerBound) * kernel.negativeCoefficient) >> 15;
+		if (force < -kernel.negativeSaturation) force = -kernel.negativeSaturation;
+	}
+	else if (deflection > kernel.upperBound)
+	{
+		force = ((int32_t) clampInt16(deflection - kernel.upperBound) * kernel.positiveCoefficient) >> 15;
+		if (force > kernel.positiveSaturation) force = kernel.positiveSaturation;
+	}
+	else return 0;
+	return -force;
+}
+
+
+//////////////// SINE KERNEL ////////////////
+
+//Phases are Q32 fractions of a turn (Q16 straight from a report), so accumulating them wraps for free
+
+//sin() over the first quarter turn in Q15, 256 steps plus the end point
+static const int16_t sineQuarterTable[257] PROGMEM =
+{
+	    0,   201,   402,   603,   804,  1005,  1206,  1407,  1608,  1809,  2009,  2210,
+	 2410,  2611,  2811,  3012,  3212,  3412,  3612,  3811,  4011,  4210,  4410,  4609,
+	 4808,  5007,  5205,  5404,  5602,  5800,  5998,  6195,  6393,  6590,  6786,  6983,
+	 7179,  7375,  7571,  7767,  7962,  8157,  8351,  8545,  8739,  8933,  9126,  9319,
+	 9512,  9704,  9896, 10087, 10278, 10469, 10659, 10849, 11039, 11228, 11417, 11605,
+	11793, 11980, 12167, 12353, 12539, 12725, 12910, 13094, 13279, 13462, 13645, 13828,
+	14010, 14191, 14372, 14553, 14732, 14912, 15090, 15269, 15446, 15623, 15800, 15976,
+	16151, 16325, 16499, 16673, 16846, 17018, 17189, 17360, 17530, 17700, 17869, 18037,
+	18204, 18371, 18537, 18703, 18868, 19032, 19195, 19357, 19519, 19680, 19841, 20000,
+	20159, 20317, 20475, 20631, 20787, 20942, 21096, 21250, 21403, 21554, 21705, 21856,
+	22005, 22154, 22301, 22448, 22594, 22739, 22884, 23027, 23170, 23311, 23452, 23592,
+	23731, 23870, 24007, 24143, 24279, 24413, 24547, 24680, 24811, 24942, 25072, 25201,
+	25329, 25456, 25582, 25708, 25832, 25955, 26077, 26198, 26319, 26438, 26556, 26674,
+	26790, 26905, 27019, 27133, 27245, 27356, 27466, 27575, 27683, 27790, 27896, 28001,
+	28105, 28208, 28310, 28411, 28510, 28609, 28706, 28803, 28898, 28992, 29085, 29177,
+	29268, 29358, 29447, 29534, 29621, 29706, 29791, 29874, 29956, 30037, 30117, 30195,
+	30273, 30349, 30424, 30498, 30571, 30643, 30714, 30783, 30852, 30919, 30985, 31050,
+	31113, 31176, 31237, 31297, 31356, 31414, 31470, 31526, 31580, 31633, 31685, 31736,
+	31785, 31833, 31880, 31926, 31971, 32014, 32057, 32098, 32137, 32176, 32213, 32250,
+	32285, 32318, 32351, 32382, 32412, 32441, 32469, 32495, 32521, 32545, 32567, 32589,
+	32609, 32628, 32646, 32663, 32678, 32692, 32705, 32717, 32728, 32737, 32745, 32752,
+	32757, 32761, 32765, 32766, 32767,
+};
+
+//PID phase is in 1/100 degree
+static inline uint16_t phaseFromCentidegrees(uint16_t phase)
+{
+	return ((uint32_t) phase << 16) / 36000;
+}
+
+//Phase increment per time unit for a period in milliseconds, rounded to the nearest
+static inline uint32_t phaseStep(uint16_t period)
+{
+	if (period == 0) return 0;
+	uint32_t divisor = (uint32_t) period * 125; //2^33 / divisor turns per unit
+	uint32_t quotient = 0xFFFFFFFFUL / divisor;
+	uint32_t remainder = 0xFFFFFFFFUL % divisor;
+	return (quotient << 1) + ((remainder << 1) + 2 >= divisor);
+}
+
+//Quarter-wave lookup with linear interpolation, result in Q15
+static inline int16_t sineQ15(uint32_t phase)
+{
+	uint8_t quadrant = phase >> 30;
+	uint32_t position = (phase >> 6) & 0xFFFFFF; //8-bit index, 16-bit fraction
+	if (quadrant & 1) position = 0x1000000 - position; //Mirror the falling quarters
+
+	uint16_t index = position >> 16;
+	uint16_t fraction = position & 0xFFFF;
+	int32_t value = (int16_t) pgm_read_word(&sineQuarterTable[index]);
+	if (fraction)
+	{
+		int32_t next = (int16_t) pgm_read_word(&sineQuarterTable[index + 1]);
+		value += ((next - value) * fraction) >> 16;
+	}
+
+	return (quadrant & 2) ? -value : value;
+}
+
+
+//////////////// ENVELOPE KERNEL ////////////////
+
+#define INFINITE_DURATION 0x7FFF
+
+//Attack and fade ramp the effect magnitude itself, levels are absolute like the magnitude
+typedef struct
+{
+	int16_t attackLevel;
+	int16_t fadeLevel;
+	uint16_t attackTime;
+	uint16_t fadeTime;
+	int32_t attackSlope; //Q16 per time unit, from attackLevel to the magnitude
+	int32_t fadeSlope; //Q16 per time unit before the end, from fadeLevel to the magnitude
+} Envelope_t;
+
+//Slopes only depend on the stored levels and times, and on the magnitude they lead to
+static inline void compileEnvelope(Envelope_t& envelope, int16_t magnitude)
+{
+	envelope.attackSlope = 0;
+	envelope.fadeSlope = 0;
+	if (envelope.attackTime > 0)
+		envelope.attackSlope = ((int32_t) magnitude - envelope.attackLevel) * 65536 / (int32_t) timeUnits(envelope.attackTime);
+	if (envelope.fadeTime > 0)
+		envelope.fadeSlope = ((int32_t) magnitude - envelope.fadeLevel) * 65536 / (int32_t) timeUnits(envelope.fadeTime);
+}
+
+//Elapsed time in time units, duration in milliseconds
+static inline int32_t envelopeAt(const Envelope_t& envelope, int16_t magnitude, uint32_t elapsedTime, uint16_t duration)
+{
+	if (envelope.fadeTime > 0 && duration != INFINITE_DURATION)
+	{
+		uint32_t end = timeUnits(duration);
+		uint32_t remaining = (elapsedTime < end) ? end - elapsedTime : 0;
+		if (remaining < timeUnits(envelope.fadeTime))
+			return envelope.fadeLevel + ((envelope.fadeSlope * (int32_t) remaining) >> 16);
+	}
+	if (elapsedTime < timeUnits(envelope.attackTime))
+		return envelope.attackLevel + ((envelope.attackSlope * (int32_t) elapsedTime) >> 16);
+	return magnitude;
+}
+
+
+//////////////// RAMP KERNEL ////////////////
+
+//Q16 per time unit, going from startMagnitude to endMagnitude over duration milliseconds
+static inline int32_t rampSlope(int16_t startMagnitude, int16_t endMagnitude, uint16_t duration)
+{
+	if (duration == 0) return 0;
+	int32_t span = (int32_t) endMagnitude - startMagnitude;
+	return span * 65536 / (int32_t) timeUnits(duration);
+}
+
+
+//////////////// MIXER ////////////////
+
+#ifndef FORCE_OUTPUT_BITS
+#define FORCE_OUTPUT_BITS 9 //Signed resolution of the final forces with the sign bit: 9 is -255..255 for an 8-bit PWM and a direction pin, 16 keeps every step the host can send
+#endif
+#if FORCE_OUTPUT_BITS < 8 || FORCE_OUTPUT_BITS > 16
+#error "FORCE_OUTPUT_BITS must be between 8 and 16"
+#endif
+#ifndef FORCE_OUTPUT_DITHER
+#define FORCE_OUTPUT_DITHER 0 //1 adds TPDF dither before the final rounding, for coarse outputs
+#endif
+
+#define OUTPUT_MAX ((1L << (FORCE_OUTPUT_BITS - 1)) - 1) //Final forces are in -OUTPUT_MAX..OUTPUT_MAX
+
+//Effects are summed as force * mix, mix folding every gain and the output scale in Q(MIX_SHIFT).
+//The shift keeps mix under 2^15 at any resolution, so an offset periodic force times mix fits in 32 bits.
+#define MIX_SHIFT (28 - FORCE_OUTPUT_BITS)
+
+//Product of two 0..255 gains in Q16
+static inline uint16_t gainProduct(uint8_t effectGain, uint8_t deviceGain)
+{
+	return ((uint32_t) (effectGain * 257U) * (deviceGain * 257U)) >> 16;
+}
+
+static inline int32_t saturatingAdd(int32_t sum, int32_t term)
+{
+	int32_t result;
+	if (__builtin_add_overflow(sum, term, &result))
+		return (term > 0) ? 0x7FFFFFFFL : -0x7FFFFFFFL - 1;
+	return result;
+}
+
+//Rounds to the nearest output step, so a full-scale force reaches OUTPUT_MAX
+static inline int32_t mixOutput(int32_t sum)
+{
+	const int32_t limit = OUTPUT_MAX << MIX_SHIFT; //Leaves headroom for the rounding
+	if (sum > limit) return OUTPUT_MAX;
+	if (sum < -limit) return -OUTPUT_MAX;
+	return (sum + (1L << (MIX_SHIFT - 1))) >> MIX_SHIFT;
+}
+
+//Triangular noise of -1..1 output step in Q(MIX_SHIFT), from two 16-bit halves of a xorshift32 draw
+static inline int32_t ditherNoise(uint32_t& state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	int32_t noise = (int32_t) (state & 0xFFFF) + (int32_t) (state >> 16) - 0xFFFF;
+#if MIX_SHIFT >= 16
+	return noise * (1L << (MIX_SHIFT - 16));
+#else
+	return noise >> (16 - MIX_SHIFT);
+#endif
+}
+
+//Rounds to the nearest output step after adding the noise, so the mean output keeps the sub-step force
+static inline int32_t mixDitheredOutput(int32_t sum, uint32_t& state)
+{
+	const int32_t limit = OUTPUT_MAX << MIX_SHIFT; //Leaves headroom for the noise and the rounding
+	if (sum > limit) sum = limit;
+	if (sum < -limit) sum = -limit;
+	int32_t output = (sum + ditherNoise(state) + (1L << (MIX_SHIFT - 1))) >> MIX_SHIFT;
+	if (output > OUTPUT_MAX) return OUTPUT_MAX;
+	if (output < -OUTPUT_MAX) return -OUTPUT_MAX;
+	return output;
+}
+
+#endif
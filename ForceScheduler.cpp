@@ -0,0 +1,141 @@
+/*
+  ForceScheduler.cpp - Fixed-rate force loop driven by a timer interrupt
+
+  Copyright (c) 2020, Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "ForceScheduler.h"
+#include <util/atomic.h>
+
+static ForceScheduler* activeScheduler = NULL; //Only one timer, so only one scheduler runs at a time
+
+static void schedulerTick()
+{
+	activeScheduler->tick();
+}
+
+
+///////////////// TIMER ////////////////
+
+//Taking Timer1 is opt-in: without POWERWHEEL_FORCE_SCHEDULER the sketch links these and keeps the timer
+//for Servo or TimerOne. ForceSchedulerTimer.h, or the host simulated timer, provides the real ones.
+__attribute__((weak)) bool startForceTimer(uint16_t rate, void (*isr)(void))
+{
+	return false;
+}
+
+__attribute__((weak)) void stopForceTimer()
+{
+}
+
+
+
+///////////////// SCHEDULING ////////////////
+
+bool ForceScheduler::begin(ForceComputer* computer, void (*apply)(void), void (*output)(int32_t* forces), uint16_t rate)
+{
+	if (activeScheduler) activeScheduler->end();
+	if (rate < FORCE_SCHEDULER_MIN_RATE) rate = FORCE_SCHEDULER_MIN_RATE;
+	if (rate > FORCE_SCHEDULER_MAX_RATE) rate = FORCE_SCHEDULER_MAX_RATE;
+
+	this->computer = computer;
+	this->apply = apply;
+	this->output = output;
+	activeRate = rate;
+	resetStats();
+
+	activeScheduler = this;
+	if (startForceTimer(rate, schedulerTick)) return true;
+
+	activeScheduler = NULL; //No timer in this build
+	activeRate = 0;
+	return false;
+}
+
+void ForceScheduler::end()
+{
+	if (activeScheduler != this) return;
+	stopForceTimer();
+	activeScheduler = NULL;
+	activeRate = 0;
+}
+
+void ForceScheduler::tick()
+{
+	uint32_t now = computer->clock();
+	if (ticking) //The previous tick is still computing: this one is dropped rather than nested
+	{
+		stats.skipped++;
+		return;
+	}
+	ticking = true;
+
+	if (stats.ticks > 0)
+	{
+		uint32_t interval = now - lastTick;
+		uint16_t measured = (interval > 0xFFFF) ? 0xFFFF : interval;
+		if (measured < stats.minPeriod) stats.minPeriod = measured;
+		if (measured > stats.maxPeriod) stats.maxPeriod = measured;
+		stats.jitterSum += (int32_t) interval - stats.period;
+	}
+	lastTick = now;
+	stats.ticks++;
+
+	interrupts(); //The clock is latched, nothing below needs the other interrupts held off
+	if (apply) apply();
+	int32_t tickForces[2];
+	computer->ComputeFinalForces(tickForces, now);
+	forces[0] = tickForces[0];
+	forces[1] = tickForces[1];
+	if (output) output(tickForces);
+
+	uint32_t busy = computer->clock() - now;
+	if (busy > stats.maxBusy) stats.maxBusy = (busy > 0xFFFF) ? 0xFFFF : busy;
+	if (busy >= stats.period) stats.overruns++; //The timer fired again meanwhile, at least one tick is late or lost
+
+	noInterrupts(); //Returns from the interrupt the way it entered
+	ticking = false;
+}
+
+void ForceScheduler::readForces(int32_t* copy)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		copy[0] = forces[0];
+		copy[1] = forces[1];
+	}
+}
+
+void ForceScheduler::readStats(ForceSchedulerStats_t* copy)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		memcpy(copy, (void*) &stats, sizeof(ForceSchedulerStats_t));
+	}
+	copy->meanPeriod = copy->period;
+	if (copy->ticks > 1)
+		copy->meanPeriod += copy->jitterSum / (int32_t) (copy->ticks - 1);
+}
+
+void ForceScheduler::resetStats()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		memset((void*) &stats, 0, sizeof(ForceSchedulerStats_t));
+		stats.period = activeRate ? 1000000UL / activeRate : 0;
+		stats.minPeriod = 0xFFFF;
+	}
+}
@@ -0,0 +1,79 @@
+/*
+  ForceScheduler.h - Fixed-rate force loop driven by a timer interrupt
+
+  Copyright (c) 2020, Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FORCESCHEDULER_h
+#define FORCESCHEDULER_h
+#include <Arduino.h>
+#include "ForceComputer.h"
+
+#define FORCE_SCHEDULER_MIN_RATE 31 //Hz, slowest rate Timer1 reaches at 16 MHz
+#define FORCE_SCHEDULER_MAX_RATE 10000
+
+
+//Timer calling isr at rate Hz: Timer1 in CTC mode on AVR (ForceSchedulerTimer.h), a simulated timer in the host build.
+//False when the sketch did not opt in to the timer.
+bool startForceTimer(uint16_t rate, void (*isr)(void));
+void stopForceTimer();
+
+
+typedef struct
+{
+	uint32_t ticks;
+	uint32_t overruns; //Ticks whose work took longer than one period
+	uint32_t skipped; //Timer events that came while the previous tick was still running, dropped
+	uint16_t period; //Nominal, in microseconds
+	uint16_t minPeriod; //Measured between consecutive tick starts, in microseconds
+	uint16_t maxPeriod;
+	uint16_t meanPeriod; //Filled in by readStats
+	uint16_t maxBusy; //Longest tick, in microseconds
+	int32_t jitterSum; //Sum of measured minus nominal periods
+} ForceSchedulerStats_t;
+
+
+//Applies queued PID reports, computes the forces and hands them to the motor output on every
+//timer tick. A tick turns interrupts back on once it has read the clock, so encoder edges, USB
+//requests and the Timer0 overflow are served while it computes. The main loop polls the endpoint.
+class ForceScheduler
+{
+public:
+
+	bool begin(ForceComputer* computer, void (*apply)(void), void (*output)(int32_t* forces), uint16_t rate); //False without a timer
+	void end();
+	bool running() const { return activeRate != 0; }
+	void tick(); //Timer interrupt body
+
+	//Main loop side
+	void readForces(int32_t* forces); //Last forces published by a tick
+	void readStats(ForceSchedulerStats_t* copy);
+	void resetStats();
+
+private:
+
+	ForceComputer* computer = NULL;
+	void (*apply)(void) = NULL; //Casts the queued PID reports into the computer
+	void (*output)(int32_t* forces) = NULL; //Motor output
+	volatile uint16_t activeRate = 0;
+	volatile bool ticking = false; //A tick is running, with interrupts enabled
+
+	volatile int32_t forces[2] = { 0, 0 };
+	volatile ForceSchedulerStats_t stats;
+	uint32_t lastTick = 0;
+};
+
+#endif
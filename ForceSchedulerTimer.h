@@ -0,0 +1,70 @@
+/*
+  ForceSchedulerTimer.h - Timer1 interrupt of the force scheduler, compiled into the sketch that opts in
+
+  Copyright (c) 2020, Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Included by PowerWheel.h when POWERWHEEL_FORCE_SCHEDULER is defined, in one file of the sketch only.
+//It defines TIMER1_COMPA_vect, so it cannot be combined with Servo or TimerOne.
+
+#ifndef FORCESCHEDULERTIMER_h
+#define FORCESCHEDULERTIMER_h
+#include "ForceScheduler.h"
+#include <util/atomic.h>
+
+#ifdef __AVR__
+static void (*forceTimerIsr)(void) = NULL;
+
+ISR(TIMER1_COMPA_vect)
+{
+	forceTimerIsr();
+}
+
+bool startForceTimer(uint16_t rate, void (*isr)(void))
+{
+	uint32_t top = F_CPU / rate;
+	uint8_t clockSelect = _BV(CS10); //No prescaling
+	if (top > 0x10000)
+	{
+		top >>= 3;
+		clockSelect = _BV(CS11); //Clock / 8
+	}
+	if (top > 0x10000) top = 0x10000;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		forceTimerIsr = isr;
+		TCCR1A = 0;
+		TCCR1B = _BV(WGM12) | clockSelect; //CTC, top is OCR1A
+		OCR1A = top - 1;
+		TCNT1 = 0;
+		TIFR1 = _BV(OCF1A);
+		TIMSK1 |= _BV(OCIE1A);
+	}
+	return true;
+}
+
+void stopForceTimer()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		TIMSK1 &= ~_BV(OCIE1A);
+		TCCR1B = 0;
+	}
+}
+#endif
+
+#endif
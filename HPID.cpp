@@ -53,7 +53,7 @@ int HID_::getDescriptor(USBSetup& setup)
 	int total = 0;
 	HIDSubDescriptor* node;
 	for (node = rootNode; node; node = node->next) {
-		int res = USB_SendControl(0, node->data, node->length);
+		int res = USB_SendControl(TRANSFER_PGM, node->data, node->length);
 		if (res == -1)
 			return -1;
 		total += res;
@@ -103,15 +103,66 @@ int HID_::SendReport(uint8_t id, const void* data, int len)
 	return ret + ret2;
 }
 
+bool HID_::PostReport(const uint8_t* packet, uint8_t len)
+{
+	if (pendingReport) reportsCoalesced++;
+	pendingReport = packet;
+	pendingLength = len;
+	if (FlushReport()) return true;
+	reportsStalled++;
+	return false;
+}
+
+bool HID_::FlushReport()
+{
+	if (!pendingReport) return true;
+
+	//The previous report still holds the bank until the host polls: writing now would wait for it
+	if (USB_SendSpace(HID_ENDPOINT) < pendingLength) return false;
+	if (USB_Send(HID_ENDPOINT | TRANSFER_RELEASE, pendingReport, pendingLength) < 0) return false;
+
+	pendingReport = NULL;
+	reportsSent++;
+	return true;
+}
+
 void HID_::ReceiveReport()
 {
-	if (USB_Available(PID_ENDPOINT))
+	PollReports();
+	ApplyReports();
+}
+
+void HID_::PollReports()
+{
+	uint8_t length;
+	while ((length = USB_Available(PID_ENDPOINT)) > 0)
 	{
-		uint8_t ffbReport[PID_REPORT_SIZE];
-		if (USB_Recv(PID_ENDPOINT, &ffbReport, PID_REPORT_SIZE) >= 0)
-		{
-			forceComputer.castReport(ffbReport, PID_REPORT_SIZE);
-		}
+		uint8_t* slot = pidQueue.reserve();
+		if (!slot) break; //Left in the endpoint, the host is NAKed until there is room
+
+		int received = USB_Recv(PID_ENDPOINT, slot, min(length, PID_QUEUE_SLOT_SIZE));
+		if (received < 0) break;
+#if PID_TRACE_SIZE > 0
+		trace.record(TRACE_OUTPUT, slot, received, forceComputer.clock());
+#endif
+
+		//Oversized packet: drop its tail so the next report starts on a packet boundary
+		uint8_t discard[PID_QUEUE_SLOT_SIZE];
+		for (int left = length - received ; left > 0 ; left -= PID_QUEUE_SLOT_SIZE)
+			USB_Recv(PID_ENDPOINT, discard, min(left, PID_QUEUE_SLOT_SIZE));
+
+		pidQueue.commit(received);
+	}
+}
+
+void HID_::ApplyReports()
+{
+	uint8_t length;
+	uint8_t* report;
+	while ((report = pidQueue.front(&length)) != NULL)
+	{
+		forceComputer.castReport(report, length);
+		pidQueue.pop();
 	}
 }
 
@@ -121,15 +172,16 @@ void HID_::getReport(USBSetup& setup)
 	{
 		if (setup.wValueL == 6)
 		{
-			_delay_us(500);
-			USB_SendControl(TRANSFER_RELEASE, (uint8_t*) &forceComputer.blockLoadReport, sizeof(BlockLoadReport_t));
-			forceComputer.blockLoadReport.reportId = 0;
+			//createEffect already ran for the matching SET_REPORT, so the result is ready without waiting
+			BlockLoadReport_t blockLoad;
+			forceComputer.popBlockLoad(&blockLoad);
+			USB_SendControl(TRANSFER_RELEASE, &blockLoad, sizeof(BlockLoadReport_t));
 		}
 		else if (setup.wValueL == 7)
 		{
 			PoolReport_t poolReport;
 			poolReport.reportId = setup.wValueL;
-			poolReport.ramPoolSize = 0xffff;
+			poolReport.ramPoolSize = MEMORY_SIZE;
 			poolReport.maxSimultaneousEffects = MAX_EFFECT_NUMBER;
 			poolReport.memoryManagement = 3;
 			USB_SendControl(TRANSFER_RELEASE, &poolReport, sizeof(PoolReport_t));
@@ -150,6 +202,9 @@ void HID_::setReport(USBSetup& setup)
 		{
 			CreateNewEffectReport_t newEffectReport;
 			USB_RecvControl(&newEffectReport, sizeof(CreateNewEffectReport_t));
+#if PID_TRACE_SIZE > 0
+			trace.record(TRACE_FEATURE, (uint8_t*) &newEffectReport, sizeof(CreateNewEffectReport_t), forceComputer.clock());
+#endif
 			forceComputer.createEffect(&newEffectReport);
 		}
 	}
@@ -171,11 +226,11 @@ bool HID_::setup(USBSetup& setup)
 			return true;
 		}
 		if (request == HID_GET_PROTOCOL) {
-			// TODO: Send8(protocol);
+			USB_SendControl(0, &protocol, 1);
 			return true;
 		}
 		if (request == HID_GET_IDLE) {
-			// TODO: Send8(idle);
+			USB_SendControl(0, &idle, 1);
 			return true;
 		}
 	}
@@ -189,7 +244,8 @@ bool HID_::setup(USBSetup& setup)
 			return true;
 		}
 		if (request == HID_SET_IDLE) {
-			idle = setup.wValueL;
+			// Duration in 4 ms units is the high byte, the low byte is the report ID (one input report here)
+			idle = setup.wValueH;
 			return true;
 		}
 		if (request == HID_SET_REPORT)
@@ -205,7 +261,7 @@ bool HID_::setup(USBSetup& setup)
 
 HID_::HID_(void) : PluggableUSBModule(2, 1, epType),
                    rootNode(NULL), descriptorSize(0),
-                   protocol(HID_REPORT_PROTOCOL), idle(1)
+                   protocol(HID_REPORT_PROTOCOL), idle(0)
 {
 	epType[0] = EP_TYPE_INTERRUPT_IN;
 	epType[1] = EP_TYPE_INTERRUPT_OUT;
@@ -26,6 +26,8 @@
 #include <Arduino.h>
 #include "PluggableUSB.h"
 #include "ForceComputer.h"
+#include "ReportQueue.h"
+#include "ReportTrace.h"
 
 #if defined(USBCON)
 
@@ -93,7 +95,7 @@ typedef struct
 class HIDSubDescriptor {
 public:
   HIDSubDescriptor *next = NULL;
-  HIDSubDescriptor(const void *d, const uint16_t l, const void *d2, const uint16_t l2) : data(d), length(l), data2(d2), length2(l2) { }
+  constexpr HIDSubDescriptor(const void *d, const uint16_t l, const void *d2, const uint16_t l2) : data(d), length(l), data2(d2), length2(l2) { }
 
   const void* data;
   const uint16_t length;
@@ -106,11 +108,30 @@ class HID_ : public PluggableUSBModule
 public:
   HID_(void);
   int begin(void);
-  int SendReport(uint8_t id, const void* data, int len);
-  void ReceiveReport(); //Retrieve data from PID_ENDPOINT buffer
+  int SendReport(uint8_t id, const void* data, int len); //Blocking, ID and payload written separately
+
+  //Never blocks: packet is the report ID followed by the payload, and must stay valid until it is sent.
+  //While the previous report is still in the endpoint it waits as the pending one, a newer post replaces it.
+  bool PostReport(const uint8_t* packet, uint8_t len); //True when written to the endpoint right away
+  bool FlushReport(); //Sends the pending report if the endpoint is free, true when nothing is left waiting
+
+  uint32_t reportsSent = 0; //Written to the endpoint
+  uint32_t reportsCoalesced = 0; //Replaced by a newer post before they could be sent
+  uint32_t reportsStalled = 0; //Posts that found the endpoint busy
+
+  uint16_t IdlePeriod() const { return idle * 4; } //ms from SET_IDLE, 0 to report only on change
+  //With the force scheduler the main loop polls and the timer tick applies, pidQueue passing the reports
+  //between them. Without it ReceiveReport does both back to back, and the queue only stages a burst.
+  void ReceiveReport(); //Poll then apply every pending PID report
+  void PollReports(); //Producer: moves every report waiting in PID_ENDPOINT to pidQueue
+  void ApplyReports(); //Consumer: casts every queued report into forceComputer
   void AppendDescriptor(HIDSubDescriptor* node);
   
   ForceComputer forceComputer;
+  ReportQueue pidQueue;
+#if PID_TRACE_SIZE > 0
+  ReportTrace<PID_TRACE_SIZE> trace; //Every report as received, dump it with trace.dump(Serial)
+#endif
 
 protected:
   // Implementation of the PluggableUSBModule
@@ -127,6 +148,9 @@ private:
   HIDSubDescriptor* rootNode;
   uint16_t descriptorSize;
 
+  const uint8_t* pendingReport = NULL;
+  uint8_t pendingLength = 0;
+
   uint8_t protocol;
   uint8_t idle;
 };
@@ -11,7 +11,7 @@
   but WITHOUT ANY WARRANTY; without even the implied warranty of
   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
   GNU General Public License for more details.
-  
+
   You should have received a copy of the GNU General Public License
   along with this library. If not, see <https://www.gnu.org/licenses/>.
 */
@@ -19,58 +19,274 @@
 
 #ifndef HIDREPORTDESCRIPTOR_H
 #define HIDREPORTDESCRIPTOR_H
+#include <Arduino.h>
+
+//The descriptor and the input report layout are both generated at compile time from an
+//InputLayout, everything below is C++11 constexpr so it builds with the Arduino toolchain.
+//The application collection is left open: the PID descriptor that follows closes it.
+
+
+//////////////// HID ITEMS ////////////////
+
+#define HID_USAGE_PAGE       0x04
+#define HID_USAGE            0x08
+#define HID_USAGE_MINIMUM    0x18
+#define HID_USAGE_MAXIMUM    0x28
+#define HID_LOGICAL_MINIMUM  0x14
+#define HID_LOGICAL_MAXIMUM  0x24
+#define HID_PHYSICAL_MINIMUM 0x34
+#define HID_PHYSICAL_MAXIMUM 0x44
+#define HID_UNIT_EXPONENT    0x54
+#define HID_UNIT             0x64
+#define HID_REPORT_SIZE      0x74
+#define HID_REPORT_ID        0x84
+#define HID_REPORT_COUNT     0x94
+#define HID_INPUT            0x80
+#define HID_COLLECTION       0xA0
+#define HID_END_COLLECTION   0xC0
+
+#define HID_DATA_VARIABLE    0x02 //Input flags
+#define HID_CONSTANT         0x01
+
+//One short item, prefix 0 stands for an item left out of this configuration
+struct HidItem_t
+{
+	uint8_t prefix; //Tag and data size code
+	int32_t data;
+
+	constexpr uint8_t dataSize() const { return (prefix & 3) == 3 ? 4 : prefix & 3; }
+	constexpr uint8_t length() const { return prefix ? 1 + dataSize() : 0; }
+	constexpr uint8_t byteAt(uint8_t index) const { return index == 0 ? prefix : (uint8_t) (data >> (8 * (index - 1))); }
+};
+
+//Smallest signed data size holding the value, as logical and physical bounds need
+constexpr HidItem_t hidItem(uint8_t tag, int32_t data)
+{
+	return { (uint8_t) (tag | ((data >= -128 && data <= 127) ? 1 : (data >= -32768 && data <= 32767) ? 2 : 3)), data };
+}
+
+constexpr HidItem_t hidItem(uint8_t tag)
+{
+	return { tag, 0 };
+}
+
+constexpr HidItem_t hidItemIf(bool present, HidItem_t item)
+{
+	return present ? item : HidItem_t { 0, 0 };
+}
+
+
+//////////////// INPUT LAYOUT ////////////////
+
+#define HID_WHEEL_BITS 16 //X is always the signed 16-bit wheel axis
+#define HID_MAX_AXES 8 //Y, Z, Rx, Ry, Rz, Slider, Dial, Wheel
+#define HID_HAT_BITS 4
+
+//Report after its ID: buttons, hat switches, padding to a byte, X, the other axes, padding to a byte
+template <uint8_t Buttons, uint8_t Hats, uint8_t Axes, uint8_t AxisBits, uint8_t ReportId = 1>
+struct InputLayout
+{
+	static_assert(Axes <= HID_MAX_AXES, "Generic Desktop has 8 axis usages after X");
+	static_assert(AxisBits == 8 || AxisBits == 12 || AxisBits == 16, "Axes are 8, 12 or 16 bits");
+
+	static constexpr uint8_t reportId = ReportId;
+	static constexpr uint8_t buttons = Buttons;
+	static constexpr uint8_t hats = Hats;
+	static constexpr uint8_t axes = Axes;
+	static constexpr uint8_t axisBits = AxisBits;
+	static constexpr uint16_t axisMax = (1UL << AxisBits) - 1;
+
+	//Bit offsets in the report
+	static constexpr uint16_t hatOffset = Buttons;
+	static constexpr uint8_t switchPadding = (8 - (Buttons + Hats * HID_HAT_BITS) % 8) % 8;
+	static constexpr uint16_t wheelOffset = Buttons + Hats * HID_HAT_BITS + switchPadding;
+	static constexpr uint16_t axisOffset = wheelOffset + HID_WHEEL_BITS;
+	static constexpr uint8_t axisPadding = (8 - (Axes * AxisBits) % 8) % 8;
+	static constexpr uint8_t reportSize = (axisOffset + Axes * AxisBits + axisPadding) / 8;
+
+	static constexpr HidItem_t items[] =
+	{
+		//HEADER
+		hidItem(HID_USAGE_PAGE, 0x01),          //Generic Desktop
+		hidItem(HID_USAGE, 0x04),               //Joystick
+		hidItem(HID_COLLECTION, 0x01),          //Application
+		hidItem(HID_USAGE, 0x01),               //Pointer
+		hidItem(HID_REPORT_ID, ReportId),
+		hidItem(HID_COLLECTION, 0x00),          //Physical
+		//BUTTONS
+		hidItemIf(Buttons, hidItem(HID_USAGE_PAGE, 0x09)), //Button
+		hidItemIf(Buttons, hidItem(HID_USAGE_MINIMUM, 1)),
+		hidItemIf(Buttons, hidItem(HID_USAGE_MAXIMUM, Buttons)),
+		hidItemIf(Buttons, hidItem(HID_LOGICAL_MINIMUM, 0)),
+		hidItemIf(Buttons, hidItem(HID_LOGICAL_MAXIMUM, 1)),
+		hidItemIf(Buttons, hidItem(HID_REPORT_SIZE, 1)),
+		hidItemIf(Buttons, hidItem(HID_REPORT_COUNT, Buttons)),
+		hidItemIf(Buttons, hidItem(HID_INPUT, HID_DATA_VARIABLE)),
+		hidItem(HID_USAGE_PAGE, 0x01),          //Generic Desktop
+		//HATSWITCHES, 8 is centred
+		hidItemIf(Hats, hidItem(HID_USAGE, 0x39)), //Hat Switch
+		hidItemIf(Hats, hidItem(HID_LOGICAL_MINIMUM, 0)),
+		hidItemIf(Hats, hidItem(HID_LOGICAL_MAXIMUM, 7)),
+		hidItemIf(Hats, hidItem(HID_PHYSICAL_MINIMUM, 0)),
+		hidItemIf(Hats, hidItem(HID_PHYSICAL_MAXIMUM, 315)),
+		hidItemIf(Hats, hidItem(HID_UNIT, 0x14)), //Eng Rot : Angular Pos
+		hidItemIf(Hats, hidItem(HID_REPORT_SIZE, HID_HAT_BITS)),
+		hidItemIf(Hats, hidItem(HID_REPORT_COUNT, Hats)),
+		hidItemIf(Hats, hidItem(HID_INPUT, HID_DATA_VARIABLE)),
+		hidItemIf(Hats, hidItem(HID_PHYSICAL_MAXIMUM, 0)), //Axes have no physical range
+		hidItemIf(Hats, hidItem(HID_UNIT, 0)),
+		hidItemIf(switchPadding, hidItem(HID_REPORT_SIZE, 1)),
+		hidItemIf(switchPadding, hidItem(HID_REPORT_COUNT, switchPadding)),
+		hidItemIf(switchPadding, hidItem(HID_INPUT, HID_CONSTANT)),
+		//WHEEL
+		hidItem(HID_USAGE, 0x01),               //Pointer
+		hidItem(HID_COLLECTION, 0x00),          //Physical
+		hidItem(HID_USAGE, 0x30),               //X
+		hidItem(HID_LOGICAL_MINIMUM, -32767),
+		hidItem(HID_LOGICAL_MAXIMUM, 32767),
+		hidItem(HID_REPORT_SIZE, HID_WHEEL_BITS),
+		hidItem(HID_REPORT_COUNT, 1),
+		hidItem(HID_INPUT, HID_DATA_VARIABLE),
+		//AXES
+		hidItemIf(Axes, hidItem(HID_USAGE_MINIMUM, 0x31)), //Y
+		hidItemIf(Axes, hidItem(HID_USAGE_MAXIMUM, 0x30 + Axes)),
+		hidItemIf(Axes, hidItem(HID_LOGICAL_MINIMUM, 0)),
+		hidItemIf(Axes, hidItem(HID_LOGICAL_MAXIMUM, axisMax)),
+		hidItemIf(Axes, hidItem(HID_REPORT_SIZE, AxisBits)),
+		hidItemIf(Axes, hidItem(HID_REPORT_COUNT, Axes)),
+		hidItemIf(Axes, hidItem(HID_INPUT, HID_DATA_VARIABLE)),
+		hidItemIf(axisPadding, hidItem(HID_REPORT_SIZE, 1)),
+		hidItemIf(axisPadding, hidItem(HID_REPORT_COUNT, axisPadding)),
+		hidItemIf(axisPadding, hidItem(HID_INPUT, HID_CONSTANT)),
+		hidItem(HID_END_COLLECTION),            //Physical (wheel)
+		hidItem(HID_END_COLLECTION),            //Physical
+	};
+	static constexpr uint8_t itemCount = sizeof(items) / sizeof(HidItem_t);
+};
+
+template <uint8_t Buttons, uint8_t Hats, uint8_t Axes, uint8_t AxisBits, uint8_t ReportId>
+constexpr HidItem_t InputLayout<Buttons, Hats, Axes, AxisBits, ReportId>::items[];
 
-#define HID_REPORT_DESCRIPTOR_SIZE  83
 
+//////////////// DESCRIPTOR BYTES ////////////////
 
-static const uint8_t hidReportDescriptor[] PROGMEM = 
+template <class Layout>
+constexpr uint16_t descriptorSize(uint8_t item = 0)
 {
-	//HEADER
-	0x05, 0x01,       //USAGE_PAGE (Generic Desktop)
-	0x09, 0x04,       //USAGE (Joystick)
-	0xa1, 0x01,       //COLLECTION (Application)
-	0x09, 0x01,       //USAGE (Pointer)
-	0x85, 0x01,       //REPORT_ID
-	0xa1, 0x00,       //COLLECTION (Physical)
-	//BUTTONS
-	0x05, 0x09,       //USAGE_PAGE (Button)
-	0x19, 0x01,       //USAGE_MINIMUM (1)
-	0x29, 0x14,       //USAGE_MAXIMUM (20 = 0x14)
-	0x15, 0x00,       //LOGICAL_MINIMUM (0)
-	0x25, 0x01,       //LOGICAL_MAXIMUM (1)
-	0x75, 0x01,       //REPORT_SIZE (1)
-	0x95, 0x14,       //REPORT_COUNT (20 = 0x14)
-	0x55, 0x00,       //UNIT_EXPONENT (0)
-	0x65, 0x00,       //UNIT (None)
-	0x81, 0x02,       //INPUT (Data, Var, Abs)
-	//HEADER
-	0x05, 0x01,       //USAGE_PAGE (Generic Desktop)
-	//HATSWITCH
-	0x09,0x39,       //USAGE (Hat Switch)
-	0x15, 0x00,       //LOGICAL_MINIMUM (0)
-	0x25, 0x07,       //LOGICAL_MAXIMUM (7)
-	0x35, 0x00,       //PHYSICAL_MINIMUM (0)
-	0x46, 0x3B, 0x01, //PHYSICAL_MAXIMUM (315)
-	0x65, 0x14,       //UNIT (Eng Rot : Angular Pos)
-	0x75, 0x04,       //REPORT_SIZE (4)
-	0x95, 0x01,       //REPORT_COUNT (1)
-	0x81, 0x02,       //INPUT (Data, Var, Abs)
-	//AXIS
-	0x09, 0x01,       //USAGE (Pointer)
-	0x16, 0x00, 0x00, //LOGICAL_MINIMUM (0)
-	0x26, 0xff, 0x00, //LOGICAL_MAXIMUM (255)
-	0x75, 0x08,       //REPORT_SIZE (8)
-	0x95, 0x06,       //REPORT_COUNT (6)
-	0xA1, 0x00,       //COLLECTION (Physical)
-	0x09, 0x30,       //USAGE (X)
-	0x09, 0x31,       //USAGE (Y)
-	0x09, 0x32,       //USAGE (Z)
-	0x09, 0x33,       //USAGE (Rx)
-	0x09, 0x34,       //USAGE (Ry)
-	0x09, 0x35,       //USAGE (Rz)
-	0x81, 0x02,       //INPUT (Data, Var, Abs)
-	0xc0,             //END_COLLECTION (Physical)
-	0xc0,             //END_COLLECTION
+	return item == Layout::itemCount ? 0 : Layout::items[item].length() + descriptorSize<Layout>(item + 1);
+}
+
+//Byte index of the descriptor, found by walking the items
+template <class Layout>
+constexpr uint8_t descriptorByte(uint16_t index, uint8_t item = 0)
+{
+	return index < Layout::items[item].length() ? Layout::items[item].byteAt(index)
+		: descriptorByte<Layout>(index - Layout::items[item].length(), item + 1);
+}
+
+template <uint16_t... Index> struct IndexSequence {};
+template <uint16_t Count, uint16_t... Index> struct MakeIndexSequence : MakeIndexSequence<Count - 1, Count - 1, Index...> {};
+template <uint16_t... Index> struct MakeIndexSequence<0, Index...> { typedef IndexSequence<Index...> type; };
+
+template <class Layout, class Sequence = typename MakeIndexSequence<descriptorSize<Layout>()>::type>
+struct HidReportDescriptor;
+
+template <class Layout, uint16_t... Index>
+struct HidReportDescriptor<Layout, IndexSequence<Index...> >
+{
+	static const uint16_t size = sizeof...(Index);
+	static const uint8_t data[sizeof...(Index)];
+};
+
+template <class Layout, uint16_t... Index>
+const uint8_t HidReportDescriptor<Layout, IndexSequence<Index...> >::data[sizeof...(Index)] PROGMEM =
+{
+	descriptorByte<Layout>(Index)...
+};
+
+
+//////////////// INPUT REPORT ////////////////
+
+//Report kept in its wire format, ready to send. Setters return whether the report changed.
+template <class Layout>
+class InputReport
+{
+public:
+
+	//Report ID then fields, exactly as the interrupt endpoint sends it
+	uint8_t packet[1 + Layout::reportSize];
+
+	uint8_t* data() { return &packet[1]; }
+	const uint8_t* data() const { return &packet[1]; }
+
+	InputReport()
+	{
+		memset(packet, 0, sizeof(packet));
+		packet[0] = Layout::reportId;
+		for (uint8_t i = 0 ; i < Layout::hats ; i++)
+			setHat(i, 8);
+	}
+
+	bool setButton(uint8_t index, uint8_t pressed)
+	{
+		return index < Layout::buttons && writeBits(index, 1, pressed ? 1 : 0);
+	}
+
+	bool setHat(uint8_t index, uint8_t direction) //0..7 clockwise from up, 8 centred
+	{
+		if (index >= Layout::hats) return false;
+		return writeBits(Layout::hatOffset + index * HID_HAT_BITS, HID_HAT_BITS, direction);
+	}
+
+	bool setWheel(int16_t value)
+	{
+		return writeBits(Layout::wheelOffset, HID_WHEEL_BITS, value);
+	}
+
+	bool setAxis(uint8_t index, uint16_t value) //0..Layout::axisMax
+	{
+		if (index >= Layout::axes) return false;
+		return writeBits(Layout::axisOffset + index * Layout::axisBits, Layout::axisBits, value);
+	}
+
+	int16_t wheel() const { return readBits(Layout::wheelOffset, HID_WHEEL_BITS); }
+
+	uint16_t axis(uint8_t index) const
+	{
+		if (index >= Layout::axes) return 0;
+		return readBits(Layout::axisOffset + index * Layout::axisBits, Layout::axisBits);
+	}
+
+private:
+
+	//Little-endian bit fields, as HID packs report fields
+	bool writeBits(uint16_t offset, uint8_t width, uint16_t value)
+	{
+		uint8_t* byte = &data()[offset / 8];
+		uint8_t shift = offset % 8;
+		uint32_t mask = ((1UL << width) - 1) << shift;
+		uint32_t bits = ((uint32_t) value << shift) & mask;
+		uint8_t bytes = (shift + width + 7) / 8; //A field of up to 16 bits spans at most 3 bytes
+		uint8_t changed = 0;
+		for (uint8_t n = 0 ; n < bytes ; n++, mask >>= 8, bits >>= 8)
+		{
+			uint8_t updated = (byte[n] & ~mask) | bits;
+			changed |= byte[n] ^ updated;
+			byte[n] = updated;
+		}
+		return changed;
+	}
+
+	uint16_t readBits(uint16_t offset, uint8_t width) const
+	{
+		const uint8_t* byte = &data()[offset / 8];
+		uint8_t shift = offset % 8;
+		uint8_t bytes = (shift + width + 7) / 8;
+		uint32_t bits = 0;
+		for (uint8_t n = 0 ; n < bytes ; n++)
+			bits |= (uint32_t) byte[n] << (n * 8);
+		return (bits >> shift) & ((1UL << width) - 1);
+	}
 };
 
-#endif
\ No newline at end of file
+#endif
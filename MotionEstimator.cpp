@@ -0,0 +1,167 @@
+/*
+  MotionEstimator.cpp - Wheel position, velocity and acceleration from raw encoder counts
+
+  Copyright (c) 2020, Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MotionEstimator.h"
+#include <util/atomic.h>
+
+#define MOTION_MAX_RESIDUAL (1L << 22) //Q8 counts, a bigger jump restarts the filter
+#define MOTION_MAX_GAP 4 //Samples, a longer silence restarts the filter
+
+//A full scale over range units of 2^unitShift, each value unit being perUnit of them. Saturated for tiny ranges.
+static MotionScale_t deflectionScale(uint32_t perUnit, int32_t range, uint8_t unitShift)
+{
+	MotionScale_t scale = { 0, 0, 0x7FFFFFFFL };
+	if (range <= 0) return scale;
+
+	uint64_t numerator = (uint64_t) perUnit * FORCE_FULL_SCALE;
+	uint64_t denominator = (uint64_t) range << unitShift;
+	while (numerator < (denominator << 15) && scale.shift < 47) //Past 47 the result is 0 for any value
+	{
+		numerator <<= 1;
+		scale.shift++;
+	}
+	uint64_t factor = numerator / denominator;
+	scale.factor = (factor > 0xFFFF) ? 0xFFFF : factor;
+
+	if (scale.shift < 40)
+	{
+		uint64_t limit = ((uint64_t) MOTION_MAX_DEFLECTION << scale.shift) / scale.factor;
+		if (limit < 0x7FFFFFFFUL) scale.limit = limit;
+	}
+	return scale;
+}
+
+//Clamped to MOTION_MAX_DEFLECTION. Within the limit the result takes 25 bits, so 6 more fit before the
+//final shift, and the value bits dropped beyond those are worth less than 1/64 of a deflection unit.
+static int32_t deflection(int32_t value, const MotionScale_t& scale)
+{
+	if (value > scale.limit) return MOTION_MAX_DEFLECTION;
+	if (value < -scale.limit) return -MOTION_MAX_DEFLECTION;
+	if (scale.shift < 16) return mulQ16(value * (1L << (16 - scale.shift)), scale.factor);
+
+	uint8_t shift = scale.shift - 16;
+	uint8_t dropped = (shift > 6) ? shift - 6 : 0;
+	return mulQ16(value >> dropped, scale.factor) >> (shift - dropped);
+}
+
+
+///////////////// CONFIGURATION ////////////////
+
+void MotionEstimator::begin(uint16_t rate, int32_t positionRange, int32_t velocityRange, int32_t accelerationRange)
+{
+	if (rate == 0) rate = 1;
+	this->rate = rate;
+	samplePeriod = 1000000UL / rate;
+	stepScale = ((uint64_t) rate << 29) / 1000000UL;
+
+	positionScale = deflectionScale(1, positionRange, 8);
+	velocityScale = deflectionScale(rate, velocityRange, 16);
+	accelerationScale = deflectionScale((uint32_t) rate * rate, accelerationRange, 16);
+
+	primed = 0;
+	active = 1;
+}
+
+void MotionEstimator::reset(int32_t position)
+{
+	x = position * 256;
+	v = 0;
+	a = 0;
+}
+
+
+
+///////////////// TRACKING ////////////////
+
+void MotionEstimator::update(int32_t position, uint32_t timestamp)
+{
+	if (!active) return;
+	if (position > MOTION_MAX_POSITION) position = MOTION_MAX_POSITION;
+	if (position < -MOTION_MAX_POSITION) position = -MOTION_MAX_POSITION;
+
+	uint32_t dt = timestamp - lastTimestamp;
+	if (primed && dt == 0) return; //Same instant, nothing to predict from
+	lastTimestamp = timestamp;
+
+	if (!primed || dt > MOTION_MAX_GAP * samplePeriod)
+	{
+		primed = 1;
+		reset(position);
+		publish();
+		return;
+	}
+
+	//Predict over the real step, k in Q16 samples. Every product below fits in 32 bits: dt is at most
+	//MOTION_MAX_GAP sample periods, and the Q8 residual at most MOTION_MAX_RESIDUAL.
+	int32_t k = (dt * stepScale) >> 13;
+	int32_t ak = mulQ16(a, k);
+	int32_t predicted = x + (mulQ16(v + (ak >> 1), k) >> 8);
+	v += ak;
+
+	int32_t residual = position * 256 - predicted;
+	if (residual > MOTION_MAX_RESIDUAL || residual < -MOTION_MAX_RESIDUAL)
+	{
+		reset(position);
+		publish();
+		return;
+	}
+
+	//Correct with the nominal gains, residual Q8 to the Q16 rates is the shift by 8
+	x = predicted + mulQ16(residual, MOTION_ALPHA);
+	v += mulQ16(residual * 256, MOTION_BETA);
+	a += mulQ16(residual * 256, MOTION_GAMMA2);
+	publish();
+}
+
+//Conditions read the three deflections together, possibly from the force scheduler interrupt
+void MotionEstimator::publish()
+{
+	int32_t positionDeflection = deflection(x, positionScale);
+	int32_t velocityDeflection = deflection(v, velocityScale);
+	int32_t accelerationDeflection = deflection(a, accelerationScale);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		deflections[0] = positionDeflection;
+		deflections[1] = velocityDeflection;
+		deflections[2] = accelerationDeflection;
+	}
+}
+
+void MotionEstimator::readInputs(ConditionInputs_t* inputs)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		inputs->spring = deflections[0];
+		inputs->damper = deflections[1];
+		inputs->inertia = deflections[2];
+		inputs->friction = deflections[1];
+	}
+	inputs->inertiaSign = 1;
+}
+
+int32_t MotionEstimator::velocity() const
+{
+	return mulQ16(v, rate);
+}
+
+int32_t MotionEstimator::acceleration() const
+{
+	return mulQ16(a, (uint32_t) rate * rate);
+}
@@ -0,0 +1,101 @@
+/*
+  MotionEstimator.h - Wheel position, velocity and acceleration from raw encoder counts
+
+  Copyright (c) 2020, Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MOTIONESTIMATOR_h
+#define MOTIONESTIMATOR_h
+#include <Arduino.h>
+#include "ForceKernels.h"
+
+//Critically damped alpha-beta-gamma filter, smoothing in 0..1: higher is smoother and slower to follow
+#ifndef MOTION_SMOOTHING
+#define MOTION_SMOOTHING 0.7
+#endif
+
+//Q16 gains folded at compile time, for per-sample units
+#define MOTION_ALPHA ((int32_t) ((1.0 - MOTION_SMOOTHING * MOTION_SMOOTHING * MOTION_SMOOTHING) * 65536 + 0.5))
+#define MOTION_BETA ((int32_t) (1.5 * (1.0 - MOTION_SMOOTHING) * (1.0 - MOTION_SMOOTHING) * (1.0 + MOTION_SMOOTHING) * 65536 + 0.5))
+#define MOTION_GAMMA2 ((int32_t) ((1.0 - MOTION_SMOOTHING) * (1.0 - MOTION_SMOOTHING) * (1.0 - MOTION_SMOOTHING) * 65536 + 0.5)) //2 * gamma
+
+#define MOTION_MAX_POSITION 0x7FFFFFL //Counts, the position is kept in Q8
+#define MOTION_MAX_DEFLECTION (1L << 24) //Condition inputs are clamped well past any full scale
+
+
+//value * factor >> shift in 32 bits, factor normalized by begin to keep 16 significant bits
+typedef struct
+{
+	uint16_t factor;
+	uint8_t shift;
+	int32_t limit; //Largest value whose result is still within MOTION_MAX_DEFLECTION
+} MotionScale_t;
+
+//Condition inputs in 1/10000 of their full scale, see CONDITION_SCALE
+typedef struct
+{
+	int32_t spring; //Position
+	int32_t damper; //Velocity
+	int32_t inertia; //Acceleration
+	int32_t friction; //Velocity
+	int8_t inertiaSign; //Inertia force is pushed as is, reversed or not at all
+} ConditionInputs_t;
+
+
+//Tracks the wheel from position samples taken at about rate Hz. Each update predicts from the
+//real time step, then corrects with gains compiled for the nominal one, so there is no division
+//per sample. Positions are limited to +-MOTION_MAX_POSITION counts.
+class MotionEstimator
+{
+public:
+
+	//Ranges are the full-scale condition inputs, in counts, counts/s and counts/s^2
+	void begin(uint16_t rate, int32_t positionRange, int32_t velocityRange, int32_t accelerationRange);
+	void end() { active = 0; }
+	bool running() const { return active != 0; }
+	void update(int32_t position, uint32_t timestamp); //timestamp in microseconds
+
+	void readInputs(ConditionInputs_t* inputs); //Latest estimate, safe against an update from an interrupt
+
+	//Estimated state
+	int32_t position() const { return x >> 8; } //Counts
+	int32_t velocity() const; //Counts/s
+	int32_t acceleration() const; //Counts/s^2
+
+private:
+
+	volatile uint8_t active = 0;
+	uint8_t primed = 0; //0 until the first sample, 1 until the second one
+	uint16_t rate = 0;
+	uint32_t samplePeriod = 0; //Microseconds
+	uint32_t stepScale = 0; //Q29 samples per microsecond, times the longest step still fits in 32 bits
+	uint32_t lastTimestamp = 0;
+
+	int32_t x = 0; //Q8 counts
+	int32_t v = 0; //Q16 counts per sample
+	int32_t a = 0; //Q16 counts per sample^2
+
+	//Compiled by begin: 1/10000 deflection per Q8 count, per Q16 count/sample, per Q16 count/sample^2
+	MotionScale_t positionScale = { 0, 0, 0 };
+	MotionScale_t velocityScale = { 0, 0, 0 };
+	MotionScale_t accelerationScale = { 0, 0, 0 };
+
+	volatile int32_t deflections[3] = { 0, 0, 0 }; //Position, velocity, acceleration
+	void reset(int32_t position);
+	void publish();
+};
+
+#endif
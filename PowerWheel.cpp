@@ -18,82 +18,103 @@
 
 
 #include "PowerWheel.h"
+#include <util/atomic.h>
 
 
-PowerWheel::PowerWheel()
+bool PowerWheelBase::beginEncoder(int32_t lockCounts)
 {
-	buttonValues = new uint8_t[BUTTON_BYTE_COUNT];
-	axisValues = new uint8_t[AXIS_COUNT];
-	hatSwitchValues = new uint8_t[HATSWITCH_COUNT];
+	if (lockCounts < 1) lockCounts = 1;
+	wheelLockCounts = lockCounts;
+	wheelAxisScale = ((uint32_t) WHEEL_AXIS_MAX << 16) / (uint32_t) lockCounts;
+	return encoder.begin();
+}
 
-	for (uint8_t i = 0 ; i < AXIS_COUNT ; i++)
-	{
-		axisValues[i] = 0;
-	}
-    for (uint8_t i = 0; i < BUTTON_BYTE_COUNT; i++)
-    {
-        buttonValues[i] = 0;
-    }
-	for (uint8_t i = 0 ; i < HATSWITCH_COUNT ; i++)
-	{
-		hatSwitchValues[i] = 8;
-	}
 
-	uint16_t hidReportDescriptorSize = sizeof(hidReportDescriptor) / sizeof(hidReportDescriptor[0]); //83
-	uint16_t pidReportDescriptorSize = sizeof(pidReportDescriptor) / sizeof(pidReportDescriptor[0]); //1227
-	HIDSubDescriptor* node = new HIDSubDescriptor(hidReportDescriptor, hidReportDescriptorSize, pidReportDescriptor, pidReportDescriptorSize);
-	HID().AppendDescriptor(node);
+int16_t PowerWheelBase::readEncoderAxis()
+{
+	int32_t position = encoder.read();
+	if (HID().forceComputer.motion.running())
+		updatePosition(position);
+
+	//Past full lock the axis is saturated, within it the product fits in 32 bits
+	if (position > wheelLockCounts) return WHEEL_AXIS_MAX;
+	if (position < -wheelLockCounts) return -WHEEL_AXIS_MAX;
+	return mulQ16(position, wheelAxisScale);
+}
+
+
+bool PowerWheelBase::idleExpired() const
+{
+	uint16_t period = HID().IdlePeriod();
+	return period && millis() - lastReportTime >= period;
+}
+
 
+void PowerWheelBase::reportPosted()
+{
+	lastReportTime = millis();
 }
 
 
-void PowerWheel::updateButton(uint8_t buttonIndex, uint8_t buttonValue)
+void PowerWheelBase::updateConditionValue(int16_t springCurPos, int16_t damperCurVel,int16_t inertiaCurAcc,int16_t frictionCurPos)
 {
-	bitWrite(buttonValues[buttonIndex / 8], buttonIndex % 8, buttonValue);
+    //The force scheduler tick reads them: all four change together, never half-written
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        HID().forceComputer.springCurPos = springCurPos;
+        HID().forceComputer.damperCurVel = damperCurVel;
+        HID().forceComputer.inertiaCurAcc = inertiaCurAcc;
+        HID().forceComputer.frictionCurPos = frictionCurPos;
+    }
+    HID().forceComputer.motion.end();
 }
 
 
-void PowerWheel::updateHatSwitch(uint8_t hatSwitchIndex, uint8_t hatSwitchValue)
+void PowerWheelBase::beginMotion(uint16_t rate, int32_t positionRange, int32_t velocityRange, int32_t accelerationRange)
 {
-	hatSwitchValues[hatSwitchIndex] = hatSwitchValue;
+	HID().forceComputer.motion.begin(rate, positionRange, velocityRange, accelerationRange);
 }
 
 
-void PowerWheel::updateAxis(uint8_t axisIndex, uint8_t axisValue)
+void PowerWheelBase::updatePosition(int32_t counts)
 {
-	axisValues[axisIndex] = axisValue;
+	updatePosition(counts, HID().forceComputer.clock());
 }
 
 
-void PowerWheel::updateConditionValue(int16_t springCurPos, int16_t damperCurVel,int16_t inertiaCurAcc,int16_t frictionCurPos)
+void PowerWheelBase::updatePosition(int32_t counts, uint32_t timestamp)
 {
-    HID().forceComputer.springCurPos = springCurPos;
-    HID().forceComputer.damperCurVel = damperCurVel;
-    HID().forceComputer.inertiaCurAcc = inertiaCurAcc;
-    HID().forceComputer.frictionCurPos = frictionCurPos;
+	HID().forceComputer.motion.update(counts, timestamp);
 }
 
 
-void PowerWheel::updateForces(int32_t* forces)
+void PowerWheelBase::updateForces(int32_t* forces)
 {
+	HID().FlushReport(); //A report that found the endpoint busy in pushUpdate
+	if (forceScheduler.running())
+	{
+		HID().PollReports(); //Applied by the next tick
+		forceScheduler.readForces(forces);
+		return;
+	}
 	HID().ReceiveReport();
 	HID().forceComputer.ComputeFinalForces(forces);
 }
 
 
-void PowerWheel::pushUpdate()
+static void applyReports()
 {
-	uint8_t data[hidReportSize];
-	uint8_t index = 0;
+	HID().ApplyReports();
+}
 
-	data[index++] = buttonValues[0];
-	data[index++] = buttonValues[1];
-	data[index++] = (hatSwitchValues[0] << 4) | (B00001111 & buttonValues[2]);
 
-	for (uint8_t i = 0 ; i < AXIS_COUNT ; i++)
-	{
-		data[index++] = axisValues[i];
-	}
+bool PowerWheelBase::beginForceScheduler(uint16_t rate, void (*output)(int32_t* forces))
+{
+	return forceScheduler.begin(&HID().forceComputer, applyReports, output, rate);
+}
+
 
-	HID().SendReport(hidReportId, data, hidReportSize);
+void PowerWheelBase::endForceScheduler()
+{
+	forceScheduler.end();
 }
@@ -21,37 +21,173 @@
 #define POWERWHEEL_h
 
 #include "HPID.h"
+#include "ForceScheduler.h"
+#include "QuadratureEncoder.h"
 #include "HidReportDescriptor.h"
 #include "PidReportDescriptor.h"
 
 #define REPORT_ID 1
+#ifndef BUTTON_COUNT
 #define BUTTON_COUNT 20
-#define BUTTON_BYTE_COUNT 3
+#endif
+#ifndef HATSWITCH_COUNT
 #define HATSWITCH_COUNT 1
-#define AXIS_COUNT 6
+#endif
+#ifndef AXIS_COUNT
+#define AXIS_COUNT 6 //X is the 16-bit wheel axis, the others are AXIS_BITS wide
+#endif
+#ifndef AXIS_BITS
+#define AXIS_BITS 8 //8, 12 or 16
+#endif
+#define WHEEL_AXIS_MAX 32767
 
 
-class PowerWheel
+//Everything that does not depend on the input report layout
+class PowerWheelBase
 {
 public:
-	PowerWheel();
-
-	void updateButton(uint8_t buttonIndex, uint8_t buttonValue);
-	void updateHatSwitch(uint8_t HatSwitchIndex, uint8_t HatSwitchValue);
-	void updateAxis(uint8_t axisIndex, uint8_t axisValue);
     void updateConditionValue(int16_t springCurPos, int16_t damperCurVel,int16_t inertiaCurAcc,int16_t frictionCurPos);
+
+	//Conditions from raw encoder counts instead: velocity and acceleration are estimated by the library.
+	//Ranges are the full-scale position, velocity and acceleration in counts, counts/s and counts/s^2.
+	void beginMotion(uint16_t rate, int32_t positionRange, int32_t velocityRange, int32_t accelerationRange);
+	void updatePosition(int32_t counts); //Timestamped with the force clock
+	void updatePosition(int32_t counts, uint32_t timestamp);
 	void updateForces(int32_t* forces);
+
+	//Wheel on a quadrature encoder: the X axis spans -lockCounts..lockCounts, and the motion estimator,
+	//when begun, gets every count. updateEncoder reads the position, call it from loop() before pushUpdate.
+	//Needs POWERWHEEL_ENCODER defined before including PowerWheel.h, false otherwise.
+	bool beginEncoder(int32_t lockCounts);
+	QuadratureEncoder encoder;
+
+	//Opt-in: forces computed at a fixed rate from a timer interrupt. updateForces then returns the last ones
+	//and polls the PID reports the next tick applies, keep calling it from loop().
+	//Needs POWERWHEEL_FORCE_SCHEDULER defined before including PowerWheel.h, false otherwise.
+	bool beginForceScheduler(uint16_t rate, void (*output)(int32_t* forces));
+	void endForceScheduler();
+	ForceScheduler forceScheduler;
+
+protected:
+
+	int16_t readEncoderAxis(); //Wheel axis value of the encoder position, also fed to the motion estimator
+	bool idleExpired() const; //The host asked for reports at least this often, changed or not
+	void reportPosted();
+
+private:
+
+	int32_t wheelLockCounts = 0x7FFFFFFFL; //Counts to full lock
+	uint32_t wheelAxisScale = 0; //Q16 wheel axis steps per count
+	uint32_t lastReportTime = 0;
+};
+
+
+//Buttons, hat switches and axes (X included) are fixed at compile time: all the state is in
+//statically sized members, and the input report stays packed in its wire format between updates
+template <uint8_t Buttons, uint8_t Hats, uint8_t Axes, uint8_t AxisBits = 8>
+class BasicPowerWheel : public PowerWheelBase
+{
+public:
+	static_assert(Axes >= 1, "X is always there");
+	typedef InputLayout<Buttons, Hats, Axes - 1, AxisBits, REPORT_ID> Layout;
+
+	BasicPowerWheel();
+
+	void updateButton(uint8_t buttonIndex, uint8_t buttonValue) { changed |= inputReport.setButton(buttonIndex, buttonValue); }
+	void updateHatSwitch(uint8_t hatSwitchIndex, uint8_t hatSwitchValue) { changed |= inputReport.setHat(hatSwitchIndex, hatSwitchValue); }
+	void updateAxis(uint8_t axisIndex, uint16_t axisValue); //0..2^AxisBits - 1, axis 0 is spread over the whole wheel axis
+	void updateWheelAxis(int16_t wheelValue); //-WHEEL_AXIS_MAX..WHEEL_AXIS_MAX
+	void updateEncoder() { updateWheelAxis(readEncoderAxis()); }
+
+	//Axis moves up to threshold away from the last report are carried by the next one but do not trigger it.
+	//In report units, wheel axis steps for axis 0. Default 0: any change is sent.
+	void setAxisThreshold(uint8_t axisIndex, uint16_t threshold);
+
+	//Sends the report if something changed or the host's idle period is over, never blocks (see HID_::PostReport)
 	void pushUpdate();
 
 private:
 
-	uint8_t* axisValues = NULL;
-	uint8_t* hatSwitchValues = NULL;
-    uint8_t* buttonValues = NULL;
+	uint16_t axisDistance(uint8_t axisIndex) const; //From the last report sent, in report units
 
-	uint8_t hidReportSize = 9; //2 * 8btns + (4btns+hat) + 6 * axis
-	uint8_t hidReportId = REPORT_ID;
-	
+	InputReport<Layout> inputReport;
+	InputReport<Layout> reportedInput; //As last handed to the endpoint, for the thresholds
+	uint16_t axisThresholds[Axes] = {};
+	bool changed = true;
 };
 
+typedef BasicPowerWheel<BUTTON_COUNT, HATSWITCH_COUNT, AXIS_COUNT, AXIS_BITS> PowerWheel;
+
+
+template <uint8_t Buttons, uint8_t Hats, uint8_t Axes, uint8_t AxisBits>
+BasicPowerWheel<Buttons, Hats, Axes, AxisBits>::BasicPowerWheel()
+{
+	//Both constant-initialized, nothing is built at startup
+	typedef HidReportDescriptor<Layout> Descriptor;
+	static HIDSubDescriptor node(Descriptor::data, Descriptor::size, pidReportDescriptor, sizeof(pidReportDescriptor));
+	static bool appended = false;
+	if (appended) return; //One descriptor per layout, however many instances
+	appended = true;
+	HID().AppendDescriptor(&node);
+}
+
+template <uint8_t Buttons, uint8_t Hats, uint8_t Axes, uint8_t AxisBits>
+void BasicPowerWheel<Buttons, Hats, Axes, AxisBits>::updateAxis(uint8_t axisIndex, uint16_t axisValue)
+{
+	if (axisIndex == 0)
+	{
+		const uint32_t axisMax = Layout::axisMax;
+		updateWheelAxis(((uint32_t) axisValue * (2 * WHEEL_AXIS_MAX) + axisMax / 2) / axisMax - WHEEL_AXIS_MAX);
+		return;
+	}
+	if (inputReport.setAxis(axisIndex - 1, axisValue) && axisDistance(axisIndex) > axisThresholds[axisIndex])
+		changed = true;
+}
+
+template <uint8_t Buttons, uint8_t Hats, uint8_t Axes, uint8_t AxisBits>
+void BasicPowerWheel<Buttons, Hats, Axes, AxisBits>::updateWheelAxis(int16_t wheelValue)
+{
+	if (wheelValue < -WHEEL_AXIS_MAX) wheelValue = -WHEEL_AXIS_MAX;
+	if (inputReport.setWheel(wheelValue) && axisDistance(0) > axisThresholds[0])
+		changed = true;
+}
+
+template <uint8_t Buttons, uint8_t Hats, uint8_t Axes, uint8_t AxisBits>
+void BasicPowerWheel<Buttons, Hats, Axes, AxisBits>::setAxisThreshold(uint8_t axisIndex, uint16_t threshold)
+{
+	if (axisIndex >= Axes) return;
+	axisThresholds[axisIndex] = threshold;
+}
+
+template <uint8_t Buttons, uint8_t Hats, uint8_t Axes, uint8_t AxisBits>
+uint16_t BasicPowerWheel<Buttons, Hats, Axes, AxisBits>::axisDistance(uint8_t axisIndex) const
+{
+	int32_t distance = axisIndex == 0 ? (int32_t) inputReport.wheel() - reportedInput.wheel()
+		: (int32_t) inputReport.axis(axisIndex - 1) - reportedInput.axis(axisIndex - 1);
+	return distance < 0 ? -distance : distance;
+}
+
+template <uint8_t Buttons, uint8_t Hats, uint8_t Axes, uint8_t AxisBits>
+void BasicPowerWheel<Buttons, Hats, Axes, AxisBits>::pushUpdate()
+{
+	if (!changed && !idleExpired())
+	{
+		HID().FlushReport(); //A report that found the endpoint busy, input-only sketches never call updateForces
+		return;
+	}
+
+	HID().PostReport(inputReport.packet, sizeof(inputReport.packet));
+	reportedInput = inputReport;
+	changed = false;
+	reportPosted();
+}
+
+//Interrupt vectors are only compiled into a sketch that asks for them
+#ifdef POWERWHEEL_FORCE_SCHEDULER
+#include "ForceSchedulerTimer.h"
+#endif
+#ifdef POWERWHEEL_ENCODER
+#include "QuadratureEncoderInterrupts.h"
+#endif
+
 #endif
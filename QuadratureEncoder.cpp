@@ -0,0 +1,108 @@
+/*
+  QuadratureEncoder.cpp - Interrupt-driven quadrature decoder for the wheel axis
+
+  Copyright (c) 2020, Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "QuadratureEncoder.h"
+#include <util/atomic.h>
+
+QuadratureEncoder* QuadratureEncoder::activeEncoder = NULL;
+
+//Forward is 00 -> 10 -> 11 -> 01 with A in bit 1
+const int8_t QuadratureEncoder::steps[16] =
+{
+	0, -1, 1, QUADRATURE_INVALID, //From 00
+	1, 0, QUADRATURE_INVALID, -1, //From 01
+	-1, QUADRATURE_INVALID, 0, 1, //From 10
+	QUADRATURE_INVALID, 1, -1, 0, //From 11
+};
+
+void QuadratureEncoder::pinChange(uint8_t pins)
+{
+	if (activeEncoder) activeEncoder->edge(pins);
+}
+
+
+///////////////// INTERRUPTS ////////////////
+
+//INT0 and INT1 are opt-in: without POWERWHEEL_ENCODER the sketch links these and attachInterrupt keeps
+//working. QuadratureEncoderInterrupts.h, or the host simulated encoder, provides the real ones.
+__attribute__((weak)) bool startEncoderInterrupts()
+{
+	return false;
+}
+
+__attribute__((weak)) void stopEncoderInterrupts()
+{
+}
+
+
+
+///////////////// POSITION ////////////////
+
+bool QuadratureEncoder::begin()
+{
+	if (activeEncoder) activeEncoder->end();
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		state = readEncoderPins() << 2;
+		activeEncoder = this;
+		active = 1;
+	}
+	if (startEncoderInterrupts()) return true;
+
+	activeEncoder = NULL; //No interrupts in this build
+	active = 0;
+	return false;
+}
+
+void QuadratureEncoder::end()
+{
+	if (activeEncoder != this) return;
+	stopEncoderInterrupts();
+	activeEncoder = NULL;
+	active = 0;
+}
+
+int32_t QuadratureEncoder::read()
+{
+	int32_t copy;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		copy = position;
+	}
+	return copy;
+}
+
+void QuadratureEncoder::write(int32_t position)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		this->position = position;
+	}
+}
+
+uint32_t QuadratureEncoder::readErrors()
+{
+	uint32_t copy;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		copy = errors;
+	}
+	return copy;
+}
@@ -0,0 +1,90 @@
+/*
+  QuadratureEncoder.h - Interrupt-driven quadrature decoder for the wheel axis
+
+  Copyright (c) 2020, Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef QUADRATUREENCODER_h
+#define QUADRATUREENCODER_h
+#include <Arduino.h>
+
+//Channels on the INT0/INT1 pins of an ATmega32U4: digital 3 (PD0) and 2 (PD1) on a Leonardo or Micro
+#ifndef ENCODER_PIN_A
+#define ENCODER_PIN_A 3
+#define ENCODER_PIN_B 2
+#define ENCODER_PORT PIND
+#define ENCODER_A_BIT 0
+#define ENCODER_B_BIT 1
+#endif
+
+#define QUADRATURE_INVALID 2 //Step table entry for a transition with both channels changed
+
+
+//External interrupts on any edge of both channels: the AVR ones (QuadratureEncoderInterrupts.h), or a simulated
+//pin sequence in the host build. False when the sketch did not opt in to the interrupts.
+bool startEncoderInterrupts();
+void stopEncoderInterrupts();
+
+//Both channels, A in bit 1 and B in bit 0
+#ifdef __AVR__
+static inline uint8_t readEncoderPins()
+{
+	uint8_t port = ENCODER_PORT;
+	return (((port >> ENCODER_A_BIT) & 1) << 1) | ((port >> ENCODER_B_BIT) & 1);
+}
+#else
+uint8_t readEncoderPins();
+#endif
+
+
+//Counts every edge of both channels (4 counts per line), forward being A leading B.
+//The interrupt body is one table lookup and a 32-bit add, about 60 cycles with the
+//interrupt entry, so a 16 MHz board keeps up with 200k edges/s.
+class QuadratureEncoder
+{
+public:
+
+	bool begin(); //Starts from the current pins, at the current position. False without the interrupts
+	void end();
+	bool running() const { return active != 0; }
+
+	int32_t read(); //Position in counts, safe against the interrupt
+	void write(int32_t position);
+	uint32_t readErrors(); //Transitions where both channels changed at once, an edge was missed
+
+	//Interrupt body, pins as given by readEncoderPins
+	inline void edge(uint8_t pins)
+	{
+		uint8_t transition = state | pins;
+		state = pins << 2;
+		int8_t step = steps[transition];
+		if (step == QUADRATURE_INVALID) errors++;
+		else position += step;
+	}
+	static void pinChange(uint8_t pins); //edge() of the running encoder
+	static QuadratureEncoder* activeEncoder; //Only one pair of interrupts, so only one encoder runs at a time
+
+private:
+
+	static const int8_t steps[16]; //By previous pins << 2 | pins, kept in RAM for the interrupt
+
+	volatile uint8_t active = 0;
+	uint8_t state = 0; //Previous pins, shifted for the lookup
+	volatile int32_t position = 0;
+	volatile uint32_t errors = 0;
+};
+
+#endif
@@ -0,0 +1,57 @@
+/*
+  QuadratureEncoderInterrupts.h - INT0/INT1 interrupts of the quadrature encoder, compiled into the sketch that opts in
+
+  Copyright (c) 2020, Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Included by PowerWheel.h when POWERWHEEL_ENCODER is defined, in one file of the sketch only.
+//It defines INT0_vect and INT1_vect, so it cannot be combined with attachInterrupt.
+
+#ifndef QUADRATUREENCODERINTERRUPTS_h
+#define QUADRATUREENCODERINTERRUPTS_h
+#include "QuadratureEncoder.h"
+#include <util/atomic.h>
+
+#ifdef __AVR__
+//Straight to the inline decoder, a call through a pointer would double the interrupt time
+ISR(INT0_vect)
+{
+	QuadratureEncoder::activeEncoder->edge(readEncoderPins());
+}
+
+ISR(INT1_vect, ISR_ALIASOF(INT0_vect));
+
+bool startEncoderInterrupts()
+{
+	pinMode(ENCODER_PIN_A, INPUT_PULLUP);
+	pinMode(ENCODER_PIN_B, INPUT_PULLUP);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		EICRA = (EICRA & ~(_BV(ISC01) | _BV(ISC11))) | _BV(ISC00) | _BV(ISC10); //Any edge
+		EIFR = _BV(INTF0) | _BV(INTF1);
+		EIMSK |= _BV(INT0) | _BV(INT1);
+	}
+	return true;
+}
+
+void stopEncoderInterrupts()
+{
+	EIMSK &= ~(_BV(INT0) | _BV(INT1));
+}
+#endif
+
+#endif
@@ -0,0 +1,86 @@
+/*
+  ReportQueue.h - Single-producer/single-consumer queue of incoming PID reports
+
+  Copyright (c) 2020, Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef REPORTQUEUE_h
+#define REPORTQUEUE_h
+#include <stdint.h>
+
+#ifndef PID_QUEUE_LENGTH
+#define PID_QUEUE_LENGTH 8 //Power of two, at most 128
+#endif
+#define PID_QUEUE_SLOT_SIZE 16 //Largest PID output report (custom force data) is 16 bytes
+
+//Single core: keeping the compiler from reordering slot and index accesses is enough
+#define QUEUE_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+
+//Lock-free as long as one context only produces (reserve/commit) and one only consumes (front/pop):
+//the main loop and the force scheduler tick, or the same loop one step after the other
+class ReportQueue
+{
+public:
+
+	volatile uint16_t overflowCount = 0; //Times a report had to stay in the endpoint because the queue was full
+	volatile uint8_t highWaterMark = 0; //Most reports ever waiting at once
+
+	uint8_t size() const { return (uint8_t) (head - tail); }
+
+	//Producer side
+	uint8_t* reserve()
+	{
+		if (size() >= PID_QUEUE_LENGTH)
+		{
+			overflowCount++;
+			return NULL;
+		}
+		return slots[head & (PID_QUEUE_LENGTH - 1)];
+	}
+
+	void commit(uint8_t length)
+	{
+		lengths[head & (PID_QUEUE_LENGTH - 1)] = length;
+		QUEUE_BARRIER();
+		head++;
+		if (size() > highWaterMark) highWaterMark = size();
+	}
+
+	//Consumer side
+	uint8_t* front(uint8_t* length)
+	{
+		if (head == tail) return NULL;
+		QUEUE_BARRIER();
+		*length = lengths[tail & (PID_QUEUE_LENGTH - 1)];
+		return slots[tail & (PID_QUEUE_LENGTH - 1)];
+	}
+
+	void pop()
+	{
+		QUEUE_BARRIER();
+		tail++;
+	}
+
+private:
+
+	uint8_t slots[PID_QUEUE_LENGTH][PID_QUEUE_SLOT_SIZE];
+	uint8_t lengths[PID_QUEUE_LENGTH];
+	volatile uint8_t head = 0; //Written by the producer only
+	volatile uint8_t tail = 0; //Written by the consumer only
+};
+
+#endif
@@ -0,0 +1,218 @@
+/*
+  ReportTrace.h - Ring buffer of timestamped raw PID reports, for capturing what a game sent
+
+  Copyright (c) 2020, Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef REPORTTRACE_h
+#define REPORTTRACE_h
+#include <stdint.h>
+#include <util/atomic.h>
+
+#ifndef PID_TRACE_SIZE
+#define PID_TRACE_SIZE 0 //Bytes kept, 0 leaves the capture out
+#endif
+
+//Where a report came from, in the top bits of its record header
+#define TRACE_OUTPUT 0 //Interrupt OUT, as taken from the PID endpoint
+#define TRACE_FEATURE 1 //SET_REPORT feature data (Create New Effect)
+
+#define TRACE_MAX_LENGTH 63
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 15
+
+//Record: header (source << 6 | length), microseconds since the previous record as a base-128 varint, the report.
+//Dump: "PIDT", version, base time (u32), dropped records (u32), byte count (u16), then the records oldest first.
+//The oldest records are overwritten once the ring is full.
+template <uint16_t Size>
+class ReportTrace
+{
+public:
+
+	volatile bool enabled = true;
+
+	//From the endpoint poll and the control request handler, whichever context they run in
+	void record(uint8_t source, const uint8_t* report, uint8_t length, uint32_t timestamp)
+	{
+		if (!enabled) return;
+		if (length > TRACE_MAX_LENGTH) length = TRACE_MAX_LENGTH;
+
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			if (used == 0) baseTime = lastTime = timestamp;
+			uint32_t delta = timestamp - lastTime;
+			uint8_t recordSize = 1 + varintSize(delta) + length;
+			if (recordSize > Size) return;
+			while (Size - used < recordSize) dropOldest();
+
+			put(source << 6 | length);
+			for ( ; delta >= 0x80 ; delta >>= 7) put(delta | 0x80);
+			put(delta);
+			for (uint8_t n = 0 ; n < length ; n++) put(report[n]);
+			lastTime = timestamp;
+		}
+	}
+
+	void clear()
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			used = 0;
+			dropped = 0;
+		}
+	}
+
+	uint16_t size() const { return used; }
+	uint32_t droppedRecords() const { return dropped; }
+
+	//Capture is paused while dumping, out is anything with write(uint8_t) such as Serial
+	template <class Output>
+	void dump(Output& out)
+	{
+		bool wasEnabled = enabled;
+		enabled = false;
+
+		static const uint8_t magic[4] = { 'P', 'I', 'D', 'T' };
+		for (uint8_t n = 0 ; n < 4 ; n++) out.write(magic[n]);
+		out.write((uint8_t) TRACE_VERSION);
+		writeLittleEndian(out, baseTime, 4);
+		writeLittleEndian(out, dropped, 4);
+		writeLittleEndian(out, used, 2);
+		for (uint16_t n = 0 ; n < used ; n++)
+			out.write(at(n));
+
+		enabled = wasEnabled;
+	}
+
+private:
+
+	uint8_t ring[Size];
+	uint16_t start = 0; //Oldest byte
+	uint16_t used = 0;
+	uint32_t baseTime = 0; //The oldest record's delta is from this time
+	uint32_t lastTime = 0;
+	uint32_t dropped = 0;
+
+	static uint8_t varintSize(uint32_t value)
+	{
+		uint8_t size = 1;
+		for ( ; value >= 0x80 ; value >>= 7) size++;
+		return size;
+	}
+
+	uint8_t at(uint16_t offset) const { return ring[(start + offset) % Size]; }
+
+	void put(uint8_t byte)
+	{
+		ring[(start + used) % Size] = byte;
+		used++;
+	}
+
+	void dropOldest()
+	{
+		uint8_t length = at(0) & TRACE_MAX_LENGTH;
+		uint16_t offset = 1;
+		uint32_t delta = 0;
+		for (uint8_t shift = 0 ; ; shift += 7)
+		{
+			uint8_t byte = at(offset++);
+			delta |= (uint32_t) (byte & 0x7F) << shift;
+			if (!(byte & 0x80)) break;
+		}
+		offset += length;
+		baseTime += delta;
+		start = (start + offset) % Size;
+		used -= offset;
+		dropped++;
+	}
+
+	template <class Output>
+	static void writeLittleEndian(Output& out, uint32_t value, uint8_t bytes)
+	{
+		for (uint8_t n = 0 ; n < bytes ; n++, value >>= 8)
+			out.write((uint8_t) value);
+	}
+};
+
+
+//Reading a dump back, on the host
+typedef struct
+{
+	uint8_t source;
+	uint8_t length;
+	uint32_t timestamp; //Same clock as the device's force clock
+	const uint8_t* report;
+} TraceRecord_t;
+
+class TraceReader
+{
+public:
+
+	//False when data does not start with a whole dump of a known version
+	bool begin(const uint8_t* data, uint32_t length)
+	{
+		if (length < TRACE_HEADER_SIZE || data[0] != 'P' || data[1] != 'I' || data[2] != 'D' || data[3] != 'T') return false;
+		if (data[4] != TRACE_VERSION) return false;
+		time = readLittleEndian(&data[5], 4);
+		dropped = readLittleEndian(&data[9], 4);
+		uint16_t bytes = readLittleEndian(&data[13], 2);
+		if (length - TRACE_HEADER_SIZE < bytes) return false;
+		next = &data[TRACE_HEADER_SIZE];
+		end = next + bytes;
+		return true;
+	}
+
+	bool read(TraceRecord_t* record)
+	{
+		if (next >= end) return false;
+		record->source = *next >> 6;
+		record->length = *next & TRACE_MAX_LENGTH;
+		next++;
+		uint32_t delta = 0;
+		for (uint8_t shift = 0 ; next < end && shift < 35 ; shift += 7)
+		{
+			uint8_t byte = *next++;
+			delta |= (uint32_t) (byte & 0x7F) << shift;
+			if (!(byte & 0x80)) break;
+		}
+		if (end - next < record->length) return false; //Truncated record
+		time += delta;
+		record->timestamp = time;
+		record->report = next;
+		next += record->length;
+		return true;
+	}
+
+	const uint8_t* dumpEnd() const { return end; } //Where a following dump would start
+	uint32_t droppedRecords() const { return dropped; }
+
+private:
+
+	const uint8_t* next = NULL;
+	const uint8_t* end = NULL;
+	uint32_t time = 0;
+	uint32_t dropped = 0;
+
+	static uint32_t readLittleEndian(const uint8_t* data, uint8_t bytes)
+	{
+		uint32_t value = 0;
+		for (uint8_t n = 0 ; n < bytes ; n++)
+			value |= (uint32_t) data[n] << (8 * n);
+		return value;
+	}
+};
+
+#endif
@@ -0,0 +1,46 @@
+/*
+  Arduino.cpp - Minimal Arduino core shim for host-native PowerWheel builds
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include <time.h>
+
+
+static uint64_t monotonicMicros()
+{
+	static uint64_t origin = 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t now = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	if (origin == 0) origin = now;
+	return now - origin;
+}
+
+uint32_t millis(void)
+{
+	return (uint32_t) (monotonicMicros() / 1000);
+}
+
+uint32_t micros(void)
+{
+	return (uint32_t) monotonicMicros();
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max)
+{
+	return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
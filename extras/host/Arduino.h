@@ -0,0 +1,57 @@
+/*
+  Arduino.h - Minimal Arduino core shim for host-native PowerWheel builds
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef ARDUINO_HOST_h
+#define ARDUINO_HOST_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <type_traits>
+
+#define PI 3.1415926535897932384626433832795
+
+//Flash storage is plain memory on the host
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+//Time is 32-bit like on the AVR core, so wrap-around behaves the same
+uint32_t millis(void);
+uint32_t micros(void);
+
+//Global interrupt flag of the simulated timer (SimulatedTimer.cpp)
+void interrupts(void);
+void noInterrupts(void);
+
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+
+//Functions rather than the core's macros, so standard headers still build
+template <class T, class U> inline typename std::common_type<T, U>::type min(T a, U b) { return a < b ? a : b; }
+template <class T, class U> inline typename std::common_type<T, U>::type max(T a, U b) { return a > b ? a : b; }
+
+#endif
@@ -0,0 +1,185 @@
+/*
+  BlockRenderTest.cpp - RenderForces blocks against the single-sample ComputeFinalForces path
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "ForceComputer.h"
+
+#define MAX_BLOCK 64
+
+static ForceComputer block;
+static ForceComputer single;
+
+static uint32_t now = 0;
+static uint32_t failures = 0;
+
+static uint32_t testClock()
+{
+	return now;
+}
+
+
+///////////////// REPORT HELPERS ////////////////
+
+//Same report to both computers
+static void send(const void* report, uint16_t size)
+{
+	uint8_t buffer[64] = { 0 };
+	memcpy(buffer, report, size);
+	block.castReport(buffer, sizeof(buffer));
+	memcpy(buffer, report, size);
+	single.castReport(buffer, sizeof(buffer));
+}
+
+static void addEffect(uint8_t effectType, uint16_t duration, uint16_t attackTime, uint16_t fadeTime, uint16_t period)
+{
+	CreateNewEffectReport_t newEffect = { 5, effectType, 0 };
+	BlockLoadReport_t blockLoad;
+	block.createEffect(&newEffect);
+	block.popBlockLoad(&blockLoad);
+	single.createEffect(&newEffect);
+	single.popBlockLoad(&blockLoad);
+	uint8_t index = blockLoad.effectBlockIndex;
+
+	SetEffectReport_t effect = { 1, index, effectType, duration, 0, 0, 200, 0xFF, 0x03, 0, 0 };
+	send(&effect, sizeof(effect));
+	SetEnvelopeReport_t envelope = { 2, index, 1000, 3000, attackTime, fadeTime };
+	send(&envelope, sizeof(envelope));
+
+	if (effectType == 1)
+	{
+		SetConstantForceReport_t constant = { 5, index, -7000 };
+		send(&constant, sizeof(constant));
+	}
+	else if (effectType == 2)
+	{
+		SetRampForceReport_t ramp = { 6, index, 8000, -6000 };
+		send(&ramp, sizeof(ramp));
+	}
+	else if (effectType <= 7)
+	{
+		SetPeriodicReport_t periodic = { 4, index, 6000, -1500, 4500, period };
+		send(&periodic, sizeof(periodic));
+	}
+	else
+	{
+		for (uint8_t axis = 0 ; axis < 2 ; axis++)
+		{
+			SetConditionReport_t condition = { 3, index, axis, (int16_t) (axis * 300), 8000, 6000, 9000, 7000, 200 };
+			send(&condition, sizeof(condition));
+		}
+	}
+
+	EffectOperationReport_t operation = { 10, index, 1, (uint8_t) (duration == INFINITE_DURATION ? 0xFF : 1) };
+	send(&operation, sizeof(operation));
+}
+
+static void addEffects()
+{
+	BlockFreeReport_t freeAll = { 11, 255 };
+	send(&freeAll, sizeof(freeAll));
+
+	for (uint8_t type = 1 ; type <= 11 ; type++)
+	{
+		addEffect(type, INFINITE_DURATION, 40, 0, 37);
+		addEffect(type, 25 + type * 7, 10, 15, 13); //Ends, and fades, at different samples of a block
+	}
+}
+
+
+///////////////// COMPARISON ////////////////
+
+static void compare(uint16_t count, uint32_t samplePeriod, uint32_t duration)
+{
+	int32_t rendered[2 * MAX_BLOCK];
+	int32_t expected[2];
+	uint32_t mismatches = 0;
+
+	for (uint32_t elapsed = 0 ; elapsed < duration ; elapsed += count * samplePeriod)
+	{
+		int16_t input = (int16_t) (elapsed / 1000 % 500) - 250;
+		block.springCurPos = single.springCurPos = input;
+		block.damperCurVel = single.damperCurVel = -input;
+		block.inertiaCurAcc = single.inertiaCurAcc = -abs(input);
+		block.frictionCurPos = single.frictionCurPos = input;
+
+		uint32_t start = now;
+		block.RenderForces(rendered, count, start, samplePeriod);
+		for (uint16_t k = 0 ; k < count ; k++)
+		{
+			single.ComputeFinalForces(expected, start + k * samplePeriod);
+			if (expected[0] != rendered[2 * k] || expected[1] != rendered[2 * k + 1])
+			{
+				if (mismatches++ < 5)
+					printf("FAIL block %u x %u us, sample %u at %u: expected %d/%d, got %d/%d\n", count,
+						samplePeriod, k, start + k * samplePeriod, expected[0], expected[1], rendered[2 * k], rendered[2 * k + 1]);
+			}
+		}
+		now = start + count * samplePeriod;
+	}
+	failures += mismatches;
+}
+
+//Starts and stops outside 1..MAX_EFFECT_NUMBER must not reach the playing list
+static void invalidIndexes()
+{
+	static const uint8_t indexes[] = { 0, MAX_EFFECT_NUMBER + 1, 254 };
+	int32_t before[2], after[2];
+	addEffects();
+	single.ComputeFinalForces(before, now);
+
+	for (uint8_t index : indexes)
+	for (uint8_t operation = 1 ; operation <= 3 ; operation++)
+	{
+		EffectOperationReport_t report = { 10, index, operation, 1 };
+		send(&report, sizeof(report));
+	}
+
+	single.ComputeFinalForces(after, now);
+	if (before[0] != after[0] || before[1] != after[1])
+	{
+		printf("FAIL invalid effect indexes changed the forces: %d/%d, then %d/%d\n", before[0], before[1], after[0], after[1]);
+		failures++;
+	}
+}
+
+int main()
+{
+	static const uint16_t counts[] = { 1, 3, 16, 64 };
+	static const uint32_t samplePeriods[] = { 125, 333, 500, 1000 };
+
+	block.clock = testClock;
+	single.clock = testClock;
+
+	for (uint16_t count : counts)
+	for (uint32_t samplePeriod : samplePeriods)
+	{
+		now = 0xFFFF0000UL; //Clock wraps a few ms in
+		addEffects();
+		compare(count, samplePeriod, 150000);
+
+		//Endless effects rebased inside a block
+		addEffects();
+		now += 0x80000000UL - 5000;
+		compare(count, samplePeriod, 20000);
+	}
+
+	invalidIndexes();
+
+	printf("block render: %u mismatching samples\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+/*
+  ConditionKernelTest.cpp - Error budget of the fixed-point condition kernel
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Built in the default and the 16-bit output configurations, see the Makefile variants
+
+#include <stdio.h>
+#include "ForceComputer.h"
+
+#define MAX_VALUE 255
+#define KERNEL_BUDGET 3 //In 1/10000 of full force
+#define ERROR_BUDGET (KERNEL_BUDGET * OUTPUT_MAX / (double) FORCE_FULL_SCALE + 0.5) //In output steps, mixOutput rounds
+
+//Float kernel ComputeConditionForce used before the fixed-point one,
+//with the deadband compared in the same 1/10000 unit as the force
+static double referenceForce(int16_t value, int16_t maxValue, int16_t cpOffset, uint16_t deadBand,
+	int16_t positiveCoefficient, int16_t negativeCoefficient,
+	int16_t positiveSaturation, int16_t negativeSaturation, uint8_t gain)
+{
+	float normalizedValue = (float) value * 1.00 / maxValue;
+	float lowerBound = (cpOffset - (float) deadBand) / 10000;
+	float upperBound = (cpOffset + (float) deadBand) / 10000;
+
+	float tempForce = 0;
+	if (normalizedValue < lowerBound)
+	{
+		tempForce = (normalizedValue - lowerBound) * negativeCoefficient;
+		tempForce = (tempForce < -negativeSaturation ? -negativeSaturation : tempForce);
+	}
+	else if (normalizedValue > upperBound)
+	{
+		tempForce = (normalizedValue - upperBound) * positiveCoefficient;
+		tempForce = (tempForce > positiveSaturation ? positiveSaturation : tempForce);
+	}
+	else return 0;
+	tempForce = -tempForce * gain / 255;
+
+	return tempForce;
+}
+
+//Gains folded into one multiplier the way CompileMix does for a spring at full device gain
+static int32_t springMix(uint8_t gain)
+{
+	return ((uint32_t) gainProduct(gain, 255) * MIX_SCALE(SPRING_GAIN) + 0x8000) >> 16;
+}
+
+int main()
+{
+	static const int16_t cpOffsets[] = { -5000, -1000, 0, 250, 4000 };
+	static const uint16_t deadBands[] = { 0, 100, 2000 };
+	static const int16_t coefficients[] = { -10000, -3000, 0, 150, 5000, 10000 };
+	static const int16_t saturations[] = { 0, 2500, 10000 };
+	static const uint8_t gains[] = { 0, 1, 128, 255 };
+
+	uint32_t samples = 0;
+	uint32_t failures = 0;
+	double maxError = 0;
+
+	for (int16_t cpOffset : cpOffsets)
+	for (uint16_t deadBand : deadBands)
+	for (int16_t positiveCoefficient : coefficients)
+	for (int16_t negativeCoefficient : coefficients)
+	for (int16_t positiveSaturation : saturations)
+	for (int16_t negativeSaturation : saturations)
+	for (uint8_t gain : gains)
+	{
+		ConditionKernel_t kernel = compileCondition(cpOffset, deadBand, positiveCoefficient,
+			negativeCoefficient, positiveSaturation, negativeSaturation);
+
+		for (int16_t value = -2 * MAX_VALUE ; value <= 2 * MAX_VALUE ; value++)
+		{
+			double expected = referenceForce(value, MAX_VALUE, cpOffset, deadBand, positiveCoefficient,
+				negativeCoefficient, positiveSaturation, negativeSaturation, gain) * OUTPUT_MAX / FORCE_FULL_SCALE;
+			expected = max((double) -OUTPUT_MAX, min((double) OUTPUT_MAX, expected)); //Same limits as the output
+			int32_t deflection = ((int32_t) value * CONDITION_SCALE(MAX_VALUE)) >> 8;
+			int32_t actual = mixOutput(conditionForce(kernel, deflection) * springMix(gain)); //As RenderEffect sums a single effect
+
+			double error = fabs(actual - expected);
+			if (error > maxError) maxError = error;
+			if (error > ERROR_BUDGET && failures++ < 10)
+			{
+				printf("FAIL value=%d cp=%d db=%u coef=%d/%d sat=%d/%d gain=%u: expected %.2f, got %d\n",
+					value, cpOffset, deadBand, positiveCoefficient, negativeCoefficient,
+					positiveSaturation, negativeSaturation, gain, expected, actual);
+			}
+			samples++;
+		}
+	}
+
+	printf("condition kernel %d bits: %u samples, max error %.3f steps (budget %.3f), %u over budget\n",
+		FORCE_OUTPUT_BITS, samples, maxError, ERROR_BUDGET, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+/*
+  ForceBenchmark.cpp - Host micro-benchmark for the ForceComputer force loop
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <chrono>
+#include "ForceComputer.h"
+
+#define BENCH_REPORT_SIZE 64 //Same as PID_REPORT_SIZE
+#define BENCH_DEFAULT_TICKS 20000
+#define BENCH_TICK_PERIOD 500 //Simulated force loop period in microseconds, 2 kHz
+
+static const char* effectNames[] =
+{
+	"", "constant", "ramp", "square", "sine", "triangle",
+	"sawtoothDown", "sawtoothUp", "spring", "damper", "inertia", "friction"
+};
+
+static volatile int32_t sink; //Keeps the optimizer from dropping the force loop
+
+static ForceComputer forceComputer;
+
+//Simulated force clock, so timings measure the kernels rather than clock_gettime
+static uint32_t benchMicros = 0;
+
+static uint32_t benchClock()
+{
+	return benchMicros;
+}
+
+
+///////////////// REPORT HELPERS ////////////////
+
+static void send(const void* report, uint16_t size)
+{
+	uint8_t buffer[BENCH_REPORT_SIZE] = { 0 };
+	memcpy(buffer, report, size);
+	forceComputer.castReport(buffer, BENCH_REPORT_SIZE);
+}
+
+static void freeAll()
+{
+	BlockFreeReport_t report = { 11, 255 };
+	send(&report, sizeof(report));
+}
+
+//Creates, parameterizes and starts one effect as a DirectInput host would
+static uint8_t addEffect(uint8_t effectType)
+{
+	CreateNewEffectReport_t newEffect = { 5, effectType, 0 };
+	forceComputer.createEffect(&newEffect);
+	BlockLoadReport_t blockLoad;
+	forceComputer.popBlockLoad(&blockLoad);
+	uint8_t index = blockLoad.effectBlockIndex;
+	if (blockLoad.loadStatus != 1) return 0;
+
+	SetEffectReport_t effect = { 1, index, effectType, 10000, 0, 0, 255, 0xFF, 0x03, 0, 0 };
+	send(&effect, sizeof(effect));
+
+	SetEnvelopeReport_t envelope = { 2, index, 2000, 1000, 500, 500 };
+	send(&envelope, sizeof(envelope));
+
+	if (effectType == 1)
+	{
+		SetConstantForceReport_t constant = { 5, index, 6000 };
+		send(&constant, sizeof(constant));
+	}
+	else if (effectType == 2)
+	{
+		SetRampForceReport_t ramp = { 6, index, -5000, 5000 };
+		send(&ramp, sizeof(ramp));
+	}
+	else if (effectType <= 7)
+	{
+		SetPeriodicReport_t periodic = { 4, index, 5000, 500, 9000, 200 };
+		send(&periodic, sizeof(periodic));
+	}
+	else
+	{
+		for (uint8_t axis = 0 ; axis < 2 ; axis++)
+		{
+			SetConditionReport_t condition = { 3, index, axis, 500, 8000, 6000, 9000, 7000, 300 };
+			send(&condition, sizeof(condition));
+		}
+	}
+
+	EffectOperationReport_t operation = { 10, index, 1, 0xFF }; //Start, looped forever
+	send(&operation, sizeof(operation));
+	return index;
+}
+
+
+///////////////// BENCHMARKS ////////////////
+
+static double timeTicks(uint32_t ticks)
+{
+	int32_t forces[2];
+	uint8_t step = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t t = 0 ; t < ticks ; t++)
+	{
+		//Sweep the condition inputs so every branch of the kernels is taken
+		int16_t pos = (int16_t) (step++) - 128;
+		forceComputer.springCurPos = pos;
+		forceComputer.damperCurVel = pos;
+		forceComputer.inertiaCurAcc = -pos;
+		forceComputer.frictionCurPos = pos;
+
+		benchMicros += BENCH_TICK_PERIOD;
+		forceComputer.ComputeFinalForces(forces, benchMicros);
+		sink = forces[0] + forces[1];
+	}
+	auto stop = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double, std::nano>(stop - start).count() / ticks;
+}
+
+static void benchEffects(uint32_t ticks)
+{
+	printf("%-14s %5s %12s %14s\n", "effect", "slots", "ns/tick", "ticks/sec");
+	for (uint8_t type = 1 ; type <= 11 ; type++)
+	{
+		freeAll();
+		for (uint8_t slots = 1 ; slots <= MAX_EFFECT_NUMBER ; slots++)
+		{
+			if (addEffect(type) == 0)
+			{
+				printf("%-14s %5u %12s\n", effectNames[type], slots, "pool full");
+				break;
+			}
+			double ns = timeTicks(ticks);
+			printf("%-14s %5u %12.1f %14.0f\n", effectNames[type], slots, ns, 1e9 / ns);
+		}
+	}
+	freeAll();
+}
+
+//Whole pool of mixed effects, rendered one sample per call and in blocks
+static void benchRender(uint32_t ticks)
+{
+	static const uint16_t counts[] = { 1, 8, 32, 64 };
+	int32_t forces[2 * 64];
+
+	freeAll();
+	for (uint8_t slot = 0 ; slot < MAX_EFFECT_NUMBER ; slot++)
+		addEffect(1 + slot % 11);
+
+	printf("\n%-16s %12s %14s\n", "RenderForces", "ns/sample", "samples/sec");
+	for (uint16_t count : counts)
+	{
+		uint32_t blocks = ticks / count + 1;
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t t = 0 ; t < blocks ; t++)
+		{
+			forceComputer.RenderForces(forces, count, benchMicros, BENCH_TICK_PERIOD);
+			benchMicros += count * BENCH_TICK_PERIOD;
+			sink = forces[0] + forces[2 * count - 1];
+		}
+		auto stop = std::chrono::steady_clock::now();
+
+		double ns = std::chrono::duration<double, std::nano>(stop - start).count() / (blocks * count);
+		printf("block of %-7u %12.1f %14.0f\n", count, ns, 1e9 / ns);
+	}
+	freeAll();
+}
+
+static void benchCastReport(uint32_t ticks)
+{
+	uint8_t index = addEffect(4);
+	SetPeriodicReport_t periodic = { 4, index, 4000, 0, 0, 100 };
+	SetConditionReport_t condition = { 3, index, 0, 0, 5000, 5000, 9000, 9000, 0 };
+	SetEffectReport_t effect = { 1, index, 4, 10000, 0, 0, 200, 0xFF, 0x03, 0, 0 };
+	EffectOperationReport_t operation = { 10, index, 1, 0 };
+
+	struct { const char* name; uint8_t* data; uint8_t size; } reports[] =
+	{
+		{ "SetEffect", (uint8_t*) &effect, sizeof(effect) },
+		{ "SetPeriodic", (uint8_t*) &periodic, sizeof(periodic) },
+		{ "SetCondition", (uint8_t*) &condition, sizeof(condition) },
+		{ "EffectOperation", (uint8_t*) &operation, sizeof(operation) },
+	};
+
+	printf("\n%-16s %12s %14s\n", "castReport", "ns/report", "reports/sec");
+	for (auto& report : reports)
+	{
+		uint8_t buffer[BENCH_REPORT_SIZE] = { 0 };
+		memcpy(buffer, report.data, report.size);
+
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t t = 0 ; t < ticks ; t++)
+		{
+			buffer[BENCH_REPORT_SIZE - 1] = (uint8_t) t; //Defeat hoisting out of the loop
+			forceComputer.castReport(buffer, BENCH_REPORT_SIZE);
+		}
+		auto stop = std::chrono::steady_clock::now();
+
+		double ns = std::chrono::duration<double, std::nano>(stop - start).count() / ticks;
+		printf("%-16s %12.1f %14.0f\n", report.name, ns, 1e9 / ns);
+	}
+	freeAll();
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t ticks = BENCH_DEFAULT_TICKS;
+	if (argc > 1) ticks = strtoul(argv[1], NULL, 10);
+	if (ticks == 0) ticks = BENCH_DEFAULT_TICKS;
+
+	forceComputer.clock = benchClock;
+
+	benchEffects(ticks);
+	benchRender(ticks);
+	benchCastReport(ticks);
+	return 0;
+}
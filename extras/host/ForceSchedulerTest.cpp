@@ -0,0 +1,101 @@
+/*
+  ForceSchedulerTest.cpp - Timing of the fixed-rate force scheduler against a simulated timer
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "ForceScheduler.h"
+#include "SimulatedTimer.h"
+
+static ForceComputer forceComputer;
+static ForceScheduler forceScheduler;
+
+static uint32_t tickWork = 0; //Simulated time each tick spends computing, in microseconds
+static uint32_t outputs = 0;
+static uint32_t failures = 0;
+
+static void output(int32_t* forces)
+{
+	advanceSimulatedTime(tickWork);
+	outputs++;
+}
+
+static void check(bool condition, const char* what)
+{
+	if (condition) return;
+	printf("FAIL %s\n", what);
+	failures++;
+}
+
+static ForceSchedulerStats_t run(uint16_t rate, uint32_t work, uint32_t duration, uint32_t blockedEvery = 0, uint32_t blockedFor = 0)
+{
+	tickWork = work;
+	outputs = 0;
+	check(forceScheduler.begin(&forceComputer, NULL, output, rate), "begin starts the timer");
+
+	//Main loop: idles, or keeps interrupts off for blockedFor out of every blockedEvery microseconds
+	for (uint32_t elapsed = 0 ; elapsed < duration ; )
+	{
+		uint32_t step = blockedEvery ? blockedEvery - blockedFor : duration;
+		advanceSimulatedTime(step);
+		if (blockedFor) advanceSimulatedTime(blockedFor, false);
+		elapsed += step + blockedFor;
+	}
+
+	ForceSchedulerStats_t stats;
+	forceScheduler.readStats(&stats);
+	forceScheduler.end();
+	printf("%5u Hz work %4u us blocked %3u/%4u us: %6u ticks, period %u..%u mean %u us, busy %u us, %u overruns, %u skipped\n",
+		rate, work, blockedFor, blockedEvery, stats.ticks, stats.minPeriod, stats.maxPeriod,
+		stats.meanPeriod, stats.maxBusy, stats.overruns, stats.skipped);
+	return stats;
+}
+
+int main()
+{
+	forceComputer.clock = simulatedMicros;
+
+	//Light load: exactly on time
+	ForceSchedulerStats_t stats = run(1000, 200, 1000000);
+	check(stats.ticks == 1000, "1 kHz runs 1000 ticks a second");
+	check(stats.minPeriod == 1000 && stats.maxPeriod == 1000, "1 kHz ticks have no jitter");
+	check(stats.overruns == 0 && stats.skipped == 0 && stats.maxBusy == 200, "light ticks never overrun");
+	check(outputs == stats.ticks, "every tick publishes its forces");
+
+	stats = run(2000, 100, 1000000);
+	check(stats.ticks == 2000 && stats.meanPeriod == 500, "2 kHz runs 2000 ticks a second");
+
+	//Interrupts disabled elsewhere delay ticks without shifting the timer
+	stats = run(1000, 200, 1000000, 1700, 300);
+	check(stats.maxPeriod > 1000 && stats.minPeriod < 1000, "blocked interrupts show up as jitter");
+	check(stats.meanPeriod == 1000, "jitter does not drift the mean period");
+	check(stats.overruns == 0, "jitter alone is no overrun");
+
+	//Ticks longer than the period
+	stats = run(1000, 1500, 1000000);
+	check(stats.overruns == stats.ticks, "every tick too long for the period overruns");
+	check(stats.ticks < 1000, "overrunning ticks are lost");
+	check(stats.minPeriod >= 1500, "overrunning ticks start back to back");
+	check(stats.skipped + 1 >= stats.ticks && stats.skipped <= stats.ticks, "the event during a tick is served and dropped, interrupts are on");
+
+	//Stopped scheduler no longer ticks
+	uint32_t before = outputs;
+	advanceSimulatedTime(10000);
+	check(outputs == before && !forceScheduler.running(), "end stops the timer");
+
+	printf("force scheduler: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
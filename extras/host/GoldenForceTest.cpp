@@ -0,0 +1,484 @@
+/*
+  GoldenForceTest.cpp - Final force time series of scripted effect sessions, checked against recorded golden files
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Built with FORCE_OUTPUT_BITS 16 so the goldens keep the full mix resolution.
+//Every scenario runs on its own ForceComputer, ticked at 1 kHz by a fake clock that wraps mid-run,
+//with the legacy condition inputs swept. `make golden` (or -u) rewrites the files after an intended change.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "ForceComputer.h"
+
+#define GOLDEN_DIR "golden"
+#define GOLDEN_LENGTH 2000 //Milliseconds per scenario
+#define GOLDEN_STEP 4 //Milliseconds between recorded samples, forces are still computed every millisecond
+#define GOLDEN_TOLERANCE 16 //Output steps out of OUTPUT_MAX, about 0.05% of full scale
+#define EDGE_JUMP (OUTPUT_MAX / 4) //A step between recorded samples larger than this is a waveform edge
+#define CLOCK_BASE (0xFFFFFFFFUL - 700000UL) //The force clock wraps 700 ms into every scenario
+
+static ForceComputer* forceComputer;
+static uint8_t effects[11]; //Block indexes the running scenario created
+static uint32_t failures = 0;
+
+static uint32_t sessionClock = CLOCK_BASE;
+
+static uint32_t testClock()
+{
+	return sessionClock;
+}
+
+static void check(bool condition, const char* what, const char* name)
+{
+	if (condition) return;
+	printf("FAIL %s: %s\n", name, what);
+	failures++;
+}
+
+
+///////////////// REPORTS ////////////////
+
+static void send(const void* report, uint16_t size)
+{
+	uint8_t buffer[64] = { 0 };
+	memcpy(buffer, report, size);
+	forceComputer->castReport(buffer, sizeof(buffer));
+}
+
+static uint8_t create(uint8_t type)
+{
+	CreateNewEffectReport_t newEffect = { 5, type, 0 };
+	BlockLoadReport_t blockLoad;
+	forceComputer->createEffect(&newEffect);
+	forceComputer->popBlockLoad(&blockLoad);
+	return blockLoad.effectBlockIndex;
+}
+
+static void setEffect(uint8_t index, uint8_t type, uint16_t duration, uint8_t gain, uint8_t directionX = 0, uint8_t directionY = 0)
+{
+	SetEffectReport_t effect = { 1, index, type, duration, 0, 0, gain, 0xFF, 0x03, directionX, directionY };
+	send(&effect, sizeof(effect));
+}
+
+static void setEnvelope(uint8_t index, uint16_t attackLevel, uint16_t fadeLevel, uint32_t attackTime, uint32_t fadeTime)
+{
+	SetEnvelopeReport_t envelope = { 2, index, attackLevel, fadeLevel, attackTime, fadeTime };
+	send(&envelope, sizeof(envelope));
+}
+
+static void setCondition(uint8_t index, uint8_t axis, int16_t cpOffset, int16_t positiveCoefficient, int16_t negativeCoefficient,
+	uint16_t positiveSaturation, uint16_t negativeSaturation, uint16_t deadBand)
+{
+	SetConditionReport_t condition = { 3, index, axis, cpOffset, positiveCoefficient, negativeCoefficient,
+		positiveSaturation, negativeSaturation, deadBand };
+	send(&condition, sizeof(condition));
+}
+
+static void setPeriodic(uint8_t index, uint16_t magnitude, int16_t offset, uint16_t phase, uint32_t period)
+{
+	SetPeriodicReport_t periodic = { 4, index, magnitude, offset, phase, period };
+	send(&periodic, sizeof(periodic));
+}
+
+static void setConstant(uint8_t index, int16_t magnitude)
+{
+	SetConstantForceReport_t constant = { 5, index, magnitude };
+	send(&constant, sizeof(constant));
+}
+
+static void setRamp(uint8_t index, int16_t start, int16_t end)
+{
+	SetRampForceReport_t ramp = { 6, index, start, end };
+	send(&ramp, sizeof(ramp));
+}
+
+static void operate(uint8_t index, uint8_t operation, uint8_t loopCount = 1)
+{
+	EffectOperationReport_t report = { 10, index, operation, loopCount };
+	send(&report, sizeof(report));
+}
+
+static void deviceControl(uint8_t control)
+{
+	DeviceControlReport_t report = { 12, control };
+	send(&report, sizeof(report));
+}
+
+static void deviceGain(uint8_t gain)
+{
+	DeviceGainReport_t report = { 13, gain };
+	send(&report, sizeof(report));
+}
+
+static void blockFree(uint8_t index)
+{
+	BlockFreeReport_t report = { 11, index };
+	send(&report, sizeof(report));
+}
+
+
+///////////////// SCENARIOS ////////////////
+
+//Each step function is called once per millisecond, before the forces of that tick are computed
+
+static void periodicSession(uint8_t type, uint32_t ms)
+{
+	if (ms == 40)
+	{
+		effects[0] = create(type);
+		setEffect(effects[0], type, 1500, 220, 0x40, 0x00);
+		setPeriodic(effects[0], 6000, 1500, 9000, 170);
+		setEnvelope(effects[0], 1000, 0, 250, 400);
+		operate(effects[0], 1);
+	}
+	if (ms == 900) setPeriodic(effects[0], 4500, -800, 27000, 95); //Parameters changed while playing
+}
+
+static void constantStep(uint32_t ms)
+{
+	if (ms == 50)
+	{
+		effects[0] = create(1);
+		setEffect(effects[0], 1, 1200, 200, 0x20, 0x60);
+		setConstant(effects[0], 7000);
+		setEnvelope(effects[0], 0, 1500, 300, 400);
+		operate(effects[0], 1);
+	}
+	if (ms == 600) setConstant(effects[0], -5000);
+	if (ms == 1400)
+	{
+		effects[1] = create(1);
+		setEffect(effects[1], 1, INFINITE_DURATION, 255);
+		setConstant(effects[1], -10000);
+		operate(effects[1], 1, 0xFF);
+	}
+}
+
+static void rampStep(uint32_t ms)
+{
+	if (ms == 10)
+	{
+		effects[0] = create(2);
+		setEffect(effects[0], 2, 700, 255);
+		setRamp(effects[0], -8000, 6000);
+		setEnvelope(effects[0], 8000, 3000, 0, 200); //Fades the end of every loop
+		operate(effects[0], 1, 2); //Stretched over two loops
+	}
+	if (ms == 1500)
+	{
+		effects[1] = create(2);
+		setEffect(effects[1], 2, 300, 160);
+		setRamp(effects[1], 9000, -2000);
+		setEnvelope(effects[1], 2000, 0, 150, 0); //Attack against the start, the larger magnitude
+		operate(effects[1], 1, 0xFF); //Holds the end once past the duration
+	}
+}
+
+static void squareStep(uint32_t ms) { periodicSession(3, ms); }
+static void sineStep(uint32_t ms) { periodicSession(4, ms); }
+static void triangleStep(uint32_t ms) { periodicSession(5, ms); }
+static void sawtoothDownStep(uint32_t ms) { periodicSession(6, ms); }
+static void sawtoothUpStep(uint32_t ms) { periodicSession(7, ms); }
+
+static void loopStep(uint32_t ms)
+{
+	if (ms == 100)
+	{
+		effects[0] = create(4);
+		setEffect(effects[0], 4, 300, 255);
+		setPeriodic(effects[0], 8000, 0, 0, 120);
+		setEnvelope(effects[0], 2000, 2000, 100, 100);
+		operate(effects[0], 1, 3); //Ends at 1000 ms
+	}
+	if (ms == 1200) operate(effects[0], 1, 1); //Restarted once more with the tripled duration kept
+	if (ms == 1500) operate(effects[0], 3); //Stopped early
+	if (ms == 1700) operate(effects[0], 2); //Started with reset
+}
+
+//Both axes have their own condition block
+static void conditionSession(uint8_t type, uint32_t ms)
+{
+	if (ms == 20)
+	{
+		effects[0] = create(type);
+		setEffect(effects[0], type, INFINITE_DURATION, 200);
+		setCondition(effects[0], 0, 1000, 7000, 5000, 9000, 8000, 500);
+		setCondition(effects[0], 1, -2500, -3000, 10000, 6000, 10000, 1500);
+		operate(effects[0], 1, 0xFF);
+	}
+	if (ms == 700) setEnvelope(effects[0], 5000, 5000, 300, 300); //Stray, must leave the conditions alone
+	if (ms == 1300) setCondition(effects[0], 0, -4000, 10000, 10000, 10000, 10000, 0);
+}
+
+static void springStep(uint32_t ms) { conditionSession(8, ms); }
+static void damperStep(uint32_t ms) { conditionSession(9, ms); }
+static void inertiaStep(uint32_t ms) { conditionSession(10, ms); }
+static void frictionStep(uint32_t ms) { conditionSession(11, ms); }
+
+//A single condition block drives both axes
+static void sharedConditionStep(uint32_t ms)
+{
+	if (ms == 0)
+	{
+		effects[0] = create(8);
+		setEffect(effects[0], 8, 1600, 255);
+		setCondition(effects[0], 0, 0, 6000, 6000, 10000, 10000, 200);
+		operate(effects[0], 1);
+	}
+}
+
+static void deviceStep(uint32_t ms)
+{
+	if (ms == 0)
+	{
+		effects[0] = create(4);
+		setEffect(effects[0], 4, INFINITE_DURATION, 255);
+		setPeriodic(effects[0], 3000, 0, 4500, 250);
+		operate(effects[0], 1, 0xFF);
+		effects[1] = create(1);
+		setEffect(effects[1], 1, INFINITE_DURATION, 180);
+		setConstant(effects[1], 2500);
+		operate(effects[1], 1, 0xFF);
+		effects[2] = create(8);
+		setEffect(effects[2], 8, INFINITE_DURATION, 128);
+		setCondition(effects[2], 0, 0, 5000, 5000, 10000, 10000, 0);
+		operate(effects[2], 1, 0xFF);
+	}
+	if (ms == 400) deviceGain(180);
+	if (ms == 800) deviceControl(5); //Pause
+	if (ms == 1000) deviceControl(6); //Continue
+	if (ms == 1300) operate(effects[1], 3);
+	if (ms == 1500) deviceGain(255);
+	if (ms == 1700) blockFree(255);
+}
+
+//Every type at once, the sum driven into the output limits
+static void mixStep(uint32_t ms)
+{
+	static const uint8_t gains[11] = { 255, 200, 90, 140, 110, 70, 60, 230, 150, 100, 190 };
+	if (ms == 0)
+	{
+		for (uint8_t type = 1 ; type <= 11 ; type++)
+		{
+			uint8_t index = effects[type - 1] = create(type);
+			setEffect(index, type, INFINITE_DURATION, gains[type - 1]);
+			if (type == 1) setConstant(index, 6000);
+			else if (type == 2) setRamp(index, -10000, 10000);
+			else if (type <= 7) setPeriodic(index, 5000 + 500 * type, 300 * type, 4000 * type, 60 + 37 * type);
+			else
+			{
+				setCondition(index, 0, 500 * type, 10000, 8000, 10000, 10000, 100 * type);
+				setCondition(index, 1, -300 * type, 4000, 9000, 7000, 10000, 50 * type);
+			}
+			operate(index, 1, 0xFF);
+		}
+	}
+	if (ms == 1000) blockFree(effects[0]); //Freed while playing
+}
+
+typedef struct
+{
+	const char* name;
+	void (*step)(uint32_t ms);
+	int32_t tolerance; //Output steps a sample may differ from its golden value
+} Scenario_t;
+
+static const Scenario_t scenarios[] =
+{
+	{ "constant", constantStep, GOLDEN_TOLERANCE },
+	{ "ramp", rampStep, GOLDEN_TOLERANCE },
+	{ "square", squareStep, GOLDEN_TOLERANCE },
+	{ "sine", sineStep, GOLDEN_TOLERANCE },
+	{ "triangle", triangleStep, GOLDEN_TOLERANCE },
+	{ "sawtooth_down", sawtoothDownStep, GOLDEN_TOLERANCE },
+	{ "sawtooth_up", sawtoothUpStep, GOLDEN_TOLERANCE },
+	{ "loop_count", loopStep, GOLDEN_TOLERANCE },
+	{ "spring", springStep, GOLDEN_TOLERANCE },
+	{ "damper", damperStep, GOLDEN_TOLERANCE },
+	{ "inertia", inertiaStep, GOLDEN_TOLERANCE },
+	{ "friction", frictionStep, GOLDEN_TOLERANCE },
+	{ "spring_shared_axis", sharedConditionStep, GOLDEN_TOLERANCE },
+	{ "device_gain_pause", deviceStep, GOLDEN_TOLERANCE },
+	{ "mix_all", mixStep, GOLDEN_TOLERANCE },
+};
+
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+#define SAMPLE_COUNT (GOLDEN_LENGTH / GOLDEN_STEP)
+
+
+///////////////// RUNNING ////////////////
+
+//Triangle wave in -255..255, integer only so the inputs are the same on every host
+static int16_t sweep(uint32_t ms, uint32_t period)
+{
+	int32_t t = ms % period;
+	int32_t half = period / 2;
+	return (int16_t) ((t < half ? t : period - t) * 510 / half - 255);
+}
+
+static void run(const Scenario_t& scenario, int32_t series[SAMPLE_COUNT][2])
+{
+	forceComputer = new ForceComputer();
+	forceComputer->clock = testClock;
+	memset(effects, 0, sizeof(effects));
+
+	for (uint32_t ms = 0 ; ms < GOLDEN_LENGTH ; ms++)
+	{
+		sessionClock = CLOCK_BASE + ms * 1000;
+		forceComputer->springCurPos = sweep(ms, 800);
+		forceComputer->damperCurVel = sweep(ms + 150, 600);
+		forceComputer->inertiaCurAcc = sweep(ms + 70, 460);
+		forceComputer->frictionCurPos = sweep(ms + 400, 900);
+		scenario.step(ms);
+
+		int32_t forces[2] = { 0, 0 };
+		forceComputer->ComputeFinalForces(forces);
+		if (ms % GOLDEN_STEP == 0)
+		{
+			series[ms / GOLDEN_STEP][0] = forces[0];
+			series[ms / GOLDEN_STEP][1] = forces[1];
+		}
+	}
+
+	delete forceComputer;
+}
+
+static void goldenPath(char* path, size_t size, const char* dir, const char* name)
+{
+	snprintf(path, size, "%s/%s.csv", dir, name);
+}
+
+static bool writeGolden(const char* path, const char* name, int32_t series[SAMPLE_COUNT][2])
+{
+	FILE* file = fopen(path, "w");
+	if (!file) return false;
+	fprintf(file, "#%s, FORCE_OUTPUT_BITS %d, written by GoldenForceTest -u\n", name, FORCE_OUTPUT_BITS);
+	fprintf(file, "#ms,x,y\n");
+	for (uint32_t n = 0 ; n < SAMPLE_COUNT ; n++)
+		fprintf(file, "%u,%d,%d\n", n * GOLDEN_STEP, series[n][0], series[n][1]);
+	return fclose(file) == 0;
+}
+
+//False when the file is missing or does not hold one sample for every recorded tick
+static bool readGolden(const char* path, int32_t series[SAMPLE_COUNT][2])
+{
+	FILE* file = fopen(path, "r");
+	if (!file) return false;
+
+	char line[128];
+	uint32_t count = 0;
+	bool valid = true;
+	while (valid && fgets(line, sizeof(line), file))
+	{
+		if (line[0] == '#' || line[0] == '\n') continue;
+		unsigned int ms;
+		int x, y;
+		valid = sscanf(line, "%u,%d,%d", &ms, &x, &y) == 3 && count < SAMPLE_COUNT && ms == count * GOLDEN_STEP;
+		if (!valid) break;
+		series[count][0] = x;
+		series[count][1] = y;
+		count++;
+	}
+	fclose(file);
+	return valid && count == SAMPLE_COUNT;
+}
+
+//A sample passes within tolerance of its golden value, or between the golden values across an edge next to it
+//(square and sawtooth steps): an edge that moved by less than one recorded step is not a deviation
+static bool matches(int32_t golden[SAMPLE_COUNT][2], uint32_t n, uint8_t axis, int32_t value, int32_t tolerance)
+{
+	int32_t expected = golden[n][axis];
+	if (abs(value - expected) <= tolerance) return true;
+
+	for (int8_t side = -1 ; side <= 1 ; side += 2)
+	{
+		if ((side < 0 && n == 0) || (side > 0 && n + 1 == SAMPLE_COUNT)) continue;
+		int32_t neighbour = golden[n + side][axis];
+		if (abs(neighbour - expected) <= EDGE_JUMP) continue;
+		if (value >= min(expected, neighbour) - tolerance && value <= max(expected, neighbour) + tolerance) return true;
+	}
+	return false;
+}
+
+static void compare(const Scenario_t& scenario, int32_t golden[SAMPLE_COUNT][2], int32_t series[SAMPLE_COUNT][2])
+{
+	uint32_t deviations = 0;
+	int32_t maxError = 0;
+	for (uint32_t n = 0 ; n < SAMPLE_COUNT ; n++)
+	{
+		for (uint8_t axis = 0 ; axis < 2 ; axis++)
+		{
+			int32_t error = abs(series[n][axis] - golden[n][axis]);
+			if (error > maxError) maxError = error;
+			if (matches(golden, n, axis, series[n][axis], scenario.tolerance)) continue;
+			if (deviations++ < 5)
+				printf("FAIL %s: %u ms axis %c, expected %d, got %d (tolerance %d)\n", scenario.name,
+					n * GOLDEN_STEP, 'X' + axis, golden[n][axis], series[n][axis], scenario.tolerance);
+		}
+	}
+	if (deviations) failures++;
+	printf("%-20s %4u samples, max difference %5d, %u deviations\n", scenario.name, SAMPLE_COUNT, maxError, deviations);
+}
+
+int main(int argc, char** argv)
+{
+	const char* dir = GOLDEN_DIR;
+	bool update = false;
+	int option;
+	while ((option = getopt(argc, argv, "ud:")) != -1)
+	{
+		if (option == 'u') update = true;
+		else if (option == 'd') dir = optarg;
+		else
+		{
+			fprintf(stderr, "usage: %s [-u] [-d golden directory]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	static int32_t series[SAMPLE_COUNT][2];
+	static int32_t golden[SAMPLE_COUNT][2];
+	char path[256];
+
+	for (uint32_t s = 0 ; s < SCENARIO_COUNT ; s++)
+	{
+		const Scenario_t& scenario = scenarios[s];
+		goldenPath(path, sizeof(path), dir, scenario.name);
+		run(scenario, series);
+
+		if (update)
+		{
+			check(writeGolden(path, scenario.name, series), "cannot write golden file", path);
+			continue;
+		}
+		if (!readGolden(path, golden))
+		{
+			check(false, "missing or malformed golden file, run make golden", path);
+			continue;
+		}
+		compare(scenario, golden, series);
+
+		//Same session again, nothing may carry over between runs
+		int32_t again[SAMPLE_COUNT][2];
+		run(scenario, again);
+		check(memcmp(again, series, sizeof(again)) == 0, "second run differs", scenario.name);
+	}
+
+	printf("golden forces: %u scenarios%s, %u failures\n", (unsigned) SCENARIO_COUNT, update ? " written" : "", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,192 @@
+/*
+  HidDescriptorTest.cpp - Generated HID descriptors against the input report layout
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "HidReportDescriptor.h"
+
+#define MAX_FIELDS 16
+
+static uint32_t failures = 0;
+
+//One input main item, as a host parser sees it
+typedef struct
+{
+	uint16_t usagePage;
+	uint16_t usage; //First one, usage minimum for a range
+	uint16_t offset; //Bits after the report ID
+	uint8_t size;
+	uint8_t count;
+	int32_t logicalMinimum;
+	int32_t logicalMaximum;
+	bool constant;
+} Field_t;
+
+typedef struct
+{
+	Field_t fields[MAX_FIELDS];
+	uint8_t fieldCount;
+	uint16_t bits;
+	int8_t openCollections;
+	uint8_t reportId;
+	bool valid;
+} Parsed_t;
+
+static int32_t itemData(const uint8_t* item, uint8_t size)
+{
+	if (size == 1) return (int8_t) item[1];
+	if (size == 2) return (int16_t) (item[1] | item[2] << 8);
+	if (size == 4) return (int32_t) (item[1] | item[2] << 8 | item[3] << 16 | (uint32_t) item[4] << 24);
+	return 0;
+}
+
+static Parsed_t parse(const uint8_t* descriptor, uint16_t length)
+{
+	Parsed_t parsed = {};
+	parsed.valid = true;
+	Field_t global = {};
+	uint16_t usage = 0;
+
+	for (uint16_t i = 0 ; i < length ; )
+	{
+		uint8_t prefix = descriptor[i];
+		uint8_t size = (prefix & 3) == 3 ? 4 : prefix & 3;
+		if (i + size >= length) { parsed.valid = false; break; }
+		int32_t data = itemData(&descriptor[i], size);
+
+		switch (prefix & 0xFC)
+		{
+			case HID_USAGE_PAGE: global.usagePage = data; break;
+			case HID_LOGICAL_MINIMUM: global.logicalMinimum = data; break;
+			case HID_LOGICAL_MAXIMUM: global.logicalMaximum = data; break;
+			case HID_REPORT_SIZE: global.size = data; break;
+			case HID_REPORT_COUNT: global.count = data; break;
+			case HID_REPORT_ID: parsed.reportId = data; break;
+			case HID_USAGE: case HID_USAGE_MINIMUM: usage = data; break;
+			case HID_COLLECTION: parsed.openCollections++; usage = 0; break;
+			case HID_END_COLLECTION: parsed.openCollections--; break;
+			case HID_INPUT:
+				if (parsed.fieldCount == MAX_FIELDS) { parsed.valid = false; break; }
+				global.usage = usage;
+				global.offset = parsed.bits;
+				global.constant = data & HID_CONSTANT;
+				parsed.fields[parsed.fieldCount++] = global;
+				parsed.bits += global.size * global.count;
+				usage = 0;
+				break;
+		}
+		i += 1 + size;
+	}
+	return parsed;
+}
+
+static void check(bool condition, const char* name, const char* what)
+{
+	if (condition) return;
+	printf("FAIL %s: %s\n", name, what);
+	failures++;
+}
+
+static const Field_t* findField(const Parsed_t& parsed, uint16_t usagePage, uint16_t usage)
+{
+	for (uint8_t n = 0 ; n < parsed.fieldCount ; n++)
+		if (!parsed.fields[n].constant && parsed.fields[n].usagePage == usagePage && parsed.fields[n].usage == usage)
+			return &parsed.fields[n];
+	return NULL;
+}
+
+static uint32_t readBits(const uint8_t* data, uint16_t offset, uint8_t width)
+{
+	uint32_t value = 0;
+	for (uint8_t n = 0 ; n < width ; n++)
+		value |= (uint32_t) ((data[(offset + n) / 8] >> ((offset + n) % 8)) & 1) << n;
+	return value;
+}
+
+template <class Layout>
+static void checkLayout(const char* name)
+{
+	typedef HidReportDescriptor<Layout> Descriptor;
+	Parsed_t parsed = parse(Descriptor::data, Descriptor::size);
+
+	check(parsed.valid, name, "descriptor does not parse");
+	check(parsed.reportId == Layout::reportId, name, "report ID");
+	check(parsed.openCollections == 1, name, "only the application collection is left for the PID descriptor to close");
+	check(parsed.bits == Layout::reportSize * 8, name, "input bits do not fill the report size");
+
+	const Field_t* buttons = findField(parsed, 0x09, 1);
+	const Field_t* hats = findField(parsed, 0x01, 0x39);
+	const Field_t* wheel = findField(parsed, 0x01, 0x30);
+	const Field_t* axes = findField(parsed, 0x01, 0x31);
+
+	check(Layout::buttons ? buttons && buttons->offset == 0 && buttons->count == Layout::buttons : !buttons, name, "buttons");
+	check(Layout::hats ? hats && hats->offset == Layout::hatOffset && hats->count == Layout::hats && hats->size == HID_HAT_BITS : !hats, name, "hats");
+	check(wheel && wheel->offset == Layout::wheelOffset && wheel->size == 16 && wheel->logicalMinimum == -32767 && wheel->logicalMaximum == 32767, name, "wheel");
+	check(Layout::axes ? axes && axes->offset == Layout::axisOffset && axes->count == Layout::axes && axes->size == Layout::axisBits
+		&& axes->logicalMinimum == 0 && axes->logicalMaximum == Layout::axisMax : !axes, name, "axes");
+	check(Layout::wheelOffset % 8 == 0, name, "wheel is not byte aligned");
+
+	//Every setter lands where the descriptor says, without touching its neighbours
+	InputReport<Layout> report;
+	check(report.packet[0] == Layout::reportId && sizeof(report.packet) == Layout::reportSize + 1u, name, "packet starts with the report ID");
+	for (uint8_t i = 0 ; i < Layout::hats ; i++)
+		check(readBits(report.data(), hats->offset + i * HID_HAT_BITS, HID_HAT_BITS) == 8, name, "hats start centred");
+
+	for (uint8_t i = 0 ; i < Layout::buttons ; i += 3)
+		report.setButton(i, 1);
+	for (uint8_t i = 0 ; i < Layout::hats ; i++)
+		report.setHat(i, i % 8);
+	report.setWheel(-12345);
+	for (uint8_t i = 0 ; i < Layout::axes ; i++)
+		report.setAxis(i, (Layout::axisMax - 7 * i) & Layout::axisMax);
+
+	for (uint8_t i = 0 ; i < Layout::buttons ; i++)
+		check(readBits(report.data(), buttons->offset + i, 1) == (i % 3 == 0), name, "button bit");
+	for (uint8_t i = 0 ; i < Layout::hats ; i++)
+		check(readBits(report.data(), hats->offset + i * HID_HAT_BITS, HID_HAT_BITS) == i % 8u, name, "hat value");
+	check((int16_t) readBits(report.data(), wheel->offset, 16) == -12345, name, "wheel value");
+	for (uint8_t i = 0 ; i < Layout::axes ; i++)
+		check(readBits(report.data(), axes->offset + i * Layout::axisBits, Layout::axisBits) == ((Layout::axisMax - 7u * i) & Layout::axisMax), name, "axis value");
+	check(report.wheel() == -12345, name, "wheel read back");
+	for (uint8_t i = 0 ; i < Layout::axes ; i++)
+		check(report.axis(i) == ((Layout::axisMax - 7u * i) & Layout::axisMax), name, "axis read back");
+
+	//Setters tell when the report changed, so unchanged updates do not have to be sent
+	check(!report.setWheel(-12345) && report.setWheel(-12344), name, "wheel change");
+	if (Layout::buttons) check(!report.setButton(0, 1) && report.setButton(0, 0) && report.setButton(0, 1), name, "button change");
+	if (Layout::hats) check(!report.setHat(0, 0) && report.setHat(0, 8) && report.setHat(0, 0), name, "hat change");
+	if (Layout::axes) check(!report.setAxis(0, Layout::axisMax) && report.setAxis(0, Layout::axisMax - 1) && report.setAxis(0, Layout::axisMax), name, "axis change");
+	report.setWheel(-12345);
+
+	for (uint8_t n = 0 ; n < parsed.fieldCount ; n++)
+		if (parsed.fields[n].constant)
+			check(readBits(report.data(), parsed.fields[n].offset, parsed.fields[n].size * parsed.fields[n].count) == 0, name, "padding written");
+
+	printf("%-10s descriptor %3u bytes, report %2u bytes\n", name, Descriptor::size, Layout::reportSize);
+}
+
+int main()
+{
+	checkLayout<InputLayout<20, 1, 5, 8> >("default");
+	checkLayout<InputLayout<32, 2, 3, 12> >("rim");
+	checkLayout<InputLayout<0, 0, 3, 16> >("pedals");
+	checkLayout<InputLayout<7, 1, 8, 12> >("unaligned");
+	checkLayout<InputLayout<1, 0, 0, 8> >("wheel only");
+
+	printf("hid descriptor: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
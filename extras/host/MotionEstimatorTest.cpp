@@ -0,0 +1,120 @@
+/*
+  MotionEstimatorTest.cpp - Motion estimator tracking of simulated encoder counts
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "MotionEstimator.h"
+
+#define RATE 1000
+#define SETTLE_SAMPLES 500
+#define TEST_SAMPLES 3000
+#define JITTER 60 //Microseconds, each sample is taken up to this far from its nominal time
+
+#define POSITION_RANGE 20000L //Counts
+#define VELOCITY_RANGE 100000L //Counts/s
+#define ACCELERATION_RANGE 2000000L //Counts/s^2
+
+static uint32_t failures = 0;
+
+typedef struct
+{
+	const char* name;
+	double (*position)(double t);
+	double (*velocity)(double t);
+	double (*acceleration)(double t);
+	double velocityBudget; //Counts/s
+	double accelerationBudget; //Counts/s^2
+} Motion_t;
+
+static double rampPosition(double t) { return -3000 + 45000 * t; }
+static double rampVelocity(double t) { return 45000; }
+static double still(double t) { return 0; }
+
+#define SINE_AMPLITUDE 15000.0
+#define SINE_PULSATION (2 * PI * 1.5)
+static double sinePosition(double t) { return SINE_AMPLITUDE * sin(SINE_PULSATION * t); }
+static double sineVelocity(double t) { return SINE_AMPLITUDE * SINE_PULSATION * cos(SINE_PULSATION * t); }
+static double sineAcceleration(double t) { return -SINE_AMPLITUDE * SINE_PULSATION * SINE_PULSATION * sin(SINE_PULSATION * t); }
+
+static void check(bool condition, const char* name, const char* what, double expected, double actual)
+{
+	if (condition) return;
+	if (failures++ < 10) printf("FAIL %s %s: expected %.1f, got %.1f\n", name, what, expected, actual);
+}
+
+static void track(const Motion_t& motion)
+{
+	MotionEstimator estimator;
+	estimator.begin(RATE, POSITION_RANGE, VELOCITY_RANGE, ACCELERATION_RANGE);
+	srand(1);
+
+	double maxVelocityError = 0;
+	double maxAccelerationError = 0;
+	uint32_t base = 0xFFFFF000UL; //Timestamps wrap early on
+
+	for (uint32_t n = 0 ; n < SETTLE_SAMPLES + TEST_SAMPLES ; n++)
+	{
+		uint32_t micros = n * (1000000UL / RATE) + rand() % (2 * JITTER + 1); //Late by 0..2 JITTER, centred on JITTER
+		double t = micros / 1e6;
+		estimator.update(lround(motion.position(t)), base + micros);
+		if (n < SETTLE_SAMPLES) continue;
+
+		double velocityError = fabs(estimator.velocity() - motion.velocity(t));
+		double accelerationError = fabs(estimator.acceleration() - motion.acceleration(t));
+		if (velocityError > maxVelocityError) maxVelocityError = velocityError;
+		if (accelerationError > maxAccelerationError) maxAccelerationError = accelerationError;
+		check(fabs(estimator.position() - motion.position(t)) <= 2, motion.name, "position", motion.position(t), estimator.position());
+		check(velocityError <= motion.velocityBudget, motion.name, "velocity", motion.velocity(t), estimator.velocity());
+		check(accelerationError <= motion.accelerationBudget, motion.name, "acceleration", motion.acceleration(t), estimator.acceleration());
+
+		//Condition inputs are the same estimate in 1/10000 of each range
+		ConditionInputs_t inputs;
+		estimator.readInputs(&inputs);
+		check(abs(inputs.spring - estimator.position() * FORCE_FULL_SCALE / POSITION_RANGE) <= 1, motion.name, "spring input",
+			(double) estimator.position() * FORCE_FULL_SCALE / POSITION_RANGE, inputs.spring);
+		check(abs(inputs.damper - (int32_t) ((int64_t) estimator.velocity() * FORCE_FULL_SCALE / VELOCITY_RANGE)) <= 1, motion.name, "damper input",
+			(double) estimator.velocity() * FORCE_FULL_SCALE / VELOCITY_RANGE, inputs.damper);
+		check(inputs.friction == inputs.damper && inputs.inertiaSign == 1, motion.name, "friction input", inputs.damper, inputs.friction);
+	}
+
+	printf("%-8s max velocity error %7.1f counts/s (budget %.0f), max acceleration error %8.1f counts/s^2 (budget %.0f)\n",
+		motion.name, maxVelocityError, motion.velocityBudget, maxAccelerationError, motion.accelerationBudget);
+}
+
+int main()
+{
+	static const Motion_t motions[] =
+	{
+		{ "still", still, still, still, 1, 1 },
+		{ "ramp", rampPosition, rampVelocity, still, 450, 45000 },
+		{ "sine", sinePosition, sineVelocity, sineAcceleration, 1500, 150000 }, //About 10% of the peak acceleration
+	};
+
+	for (const Motion_t& motion : motions)
+		track(motion);
+
+	//A long silence restarts from the new position
+	MotionEstimator estimator;
+	estimator.begin(RATE, POSITION_RANGE, VELOCITY_RANGE, ACCELERATION_RANGE);
+	for (uint32_t n = 0 ; n < 100 ; n++)
+		estimator.update(n * 50, n * 1000);
+	estimator.update(-7000, 100 * 1000 + 20000);
+	check(estimator.position() == -7000 && estimator.velocity() == 0, "gap", "position", -7000, estimator.position());
+
+	printf("motion estimator: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
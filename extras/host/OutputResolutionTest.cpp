@@ -0,0 +1,133 @@
+/*
+  OutputResolutionTest.cpp - Final force resolution and output dither checks
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Built once per output configuration, see the Makefile variants
+
+#include <stdio.h>
+#ifndef FORCE_OUTPUT_BITS
+#define DEFAULT_OUTPUT_RANGE 255 //What sketches driving PWM from forces[] have always been given
+#endif
+#include "ForceComputer.h"
+
+#define DITHER_TICKS 4096
+#define DITHER_MEAN_BUDGET 0.05 //In output steps
+#define GAIN_BUDGET (1.0 / 4096) //Relative, mix is rounded to 12 bits or more
+
+static ForceComputer forceComputer;
+static uint8_t effectIndex = 0;
+static uint32_t failures = 0;
+
+static uint32_t testClock()
+{
+	return 0;
+}
+
+static void send(const void* report, uint16_t size)
+{
+	uint8_t buffer[64] = { 0 };
+	memcpy(buffer, report, size);
+	forceComputer.castReport(buffer, sizeof(buffer));
+}
+
+//Endless constant force at full gains
+static void startConstant()
+{
+	CreateNewEffectReport_t newEffect = { 5, 1, 0 };
+	BlockLoadReport_t blockLoad;
+	forceComputer.createEffect(&newEffect);
+	forceComputer.popBlockLoad(&blockLoad);
+	effectIndex = blockLoad.effectBlockIndex;
+
+	SetEffectReport_t effect = { 1, effectIndex, 1, INFINITE_DURATION, 0, 0, 255, 0xFF, 0x03, 0, 0 };
+	send(&effect, sizeof(effect));
+	EffectOperationReport_t operation = { 10, effectIndex, 1, 0xFF };
+	send(&operation, sizeof(operation));
+}
+
+static void setMagnitude(int16_t magnitude)
+{
+	SetConstantForceReport_t constant = { 5, effectIndex, magnitude };
+	send(&constant, sizeof(constant));
+}
+
+//Output the magnitude maps to without any quantization
+static double idealOutput(int16_t magnitude)
+{
+	return (double) magnitude * OUTPUT_MAX / FORCE_FULL_SCALE;
+}
+
+int main()
+{
+	forceComputer.clock = testClock;
+	startConstant();
+
+	uint32_t samples = 0;
+	double maxError = 0;
+
+	for (int32_t magnitude = -FORCE_FULL_SCALE ; magnitude <= FORCE_FULL_SCALE ; magnitude += 7)
+	{
+		setMagnitude(magnitude);
+		double ideal = idealOutput(magnitude);
+		double budget = fabs(ideal) * GAIN_BUDGET;
+
+#if FORCE_OUTPUT_DITHER
+		int32_t sum = 0;
+		for (uint16_t tick = 0 ; tick < DITHER_TICKS ; tick++)
+		{
+			int32_t forces[2];
+			forceComputer.ComputeFinalForces(forces);
+			if (fabs(forces[0] - ideal) >= 1.5 + budget && failures++ < 10) //Rounding plus one step of noise at most
+				printf("FAIL magnitude %d: dithered output %d too far from %.3f\n", magnitude, forces[0], ideal);
+			sum += forces[0];
+		}
+		double error = fabs((double) sum / DITHER_TICKS - ideal);
+		if (error > DITHER_MEAN_BUDGET + budget && fabs(ideal) < OUTPUT_MAX - 1 && failures++ < 10)
+			printf("FAIL magnitude %d: mean output %.3f, expected %.3f\n", magnitude, (double) sum / DITHER_TICKS, ideal);
+#else
+		int32_t forces[2];
+		forceComputer.ComputeFinalForces(forces);
+		double error = fabs(forces[0] - ideal);
+		if ((error > 0.5 + budget || forces[0] != forces[1]) && failures++ < 10) //Rounded to the nearest step
+			printf("FAIL magnitude %d: output %d/%d, expected %.3f\n", magnitude, forces[0], forces[1], ideal);
+#endif
+		if (error > maxError) maxError = error;
+		samples++;
+	}
+
+	//Full scale both ways reaches the ends of the range, exactly at the default resolution
+#ifdef DEFAULT_OUTPUT_RANGE
+	const int32_t endBudget = 0;
+	if (OUTPUT_MAX != DEFAULT_OUTPUT_RANGE && failures++ < 10)
+		printf("FAIL default output range is %ld, expected %d\n", OUTPUT_MAX, DEFAULT_OUTPUT_RANGE);
+#else
+	const int32_t endBudget = OUTPUT_MAX * GAIN_BUDGET + 1;
+#endif
+	for (int16_t magnitude = -FORCE_FULL_SCALE ; magnitude <= FORCE_FULL_SCALE ; magnitude += 2 * FORCE_FULL_SCALE)
+	{
+		setMagnitude(magnitude);
+		int32_t forces[2];
+		forceComputer.ComputeFinalForces(forces);
+		int32_t limit = magnitude > 0 ? OUTPUT_MAX : -OUTPUT_MAX;
+		if (!FORCE_OUTPUT_DITHER && (abs(forces[0] - limit) > endBudget || forces[1] != forces[0]) && failures++ < 10)
+			printf("FAIL full scale %d: output %d/%d, expected %d\n", magnitude, forces[0], forces[1], limit);
+	}
+
+	printf("output %d bits%s: %u magnitudes, max error %.3f steps, %u failures\n", FORCE_OUTPUT_BITS,
+		FORCE_OUTPUT_DITHER ? " dithered" : "", samples, maxError, failures);
+	return failures ? 1 : 0;
+}
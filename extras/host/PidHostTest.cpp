@@ -0,0 +1,420 @@
+/*
+  PidHostTest.cpp - HID_ driven by a scripted USB host replaying DirectInput PID sequences
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "PowerWheel.h"
+#include "HidReportDescriptor.h"
+#include "PidReportDescriptor.h"
+#include "SimulatedTimer.h"
+#include "SimulatedUsb.h"
+
+#define FRAME_PERIOD 1000 //Full speed: one interrupt transaction per endpoint and frame
+#define SCRIPT_LENGTH 256
+#define MAX_REPORTS 1024
+#define HANDLE_COUNT 8
+#define NO_HANDLE 0xFF //Report without an effect block index to patch
+#define SETTLE_TIME 50000 //Device running on after the last report reached it
+#define RUN_TIMEOUT 2000000 //Gives up on reports that never get through
+
+typedef InputLayout<20, 1, 5, 8, 1> TestLayout;
+
+//One host action: a Create New Effect (SET_REPORT then GET_REPORT on the control pipe),
+//or an output report on the interrupt pipe, its block index taken from the effect created for handle
+typedef struct
+{
+	uint32_t delay; //Host time since the previous step, microseconds
+	bool create;
+	uint8_t handle;
+	uint8_t report[PID_QUEUE_SLOT_SIZE];
+	uint8_t length;
+} Step_t;
+
+typedef struct
+{
+	const char* name;
+	uint32_t loopPeriod; //Device main loop, polling the PID endpoint and computing forces
+	uint32_t tickPeriod; //Force scheduler tick applying the queued reports instead, 0 without the scheduler
+} Timing_t;
+
+typedef struct
+{
+	uint32_t count;
+	uint64_t latencySum;
+	uint32_t latencyMax;
+} Latency_t;
+
+static Step_t script[SCRIPT_LENGTH];
+static uint16_t scriptLength = 0;
+static uint8_t handles[HANDLE_COUNT]; //Block index the device gave each script effect
+
+//Interrupt OUT reports, in the order the host issued them
+static uint8_t issuedReports[MAX_REPORTS][PID_QUEUE_SLOT_SIZE];
+static uint8_t issuedLengths[MAX_REPORTS];
+static uint32_t issueTimes[MAX_REPORTS];
+static uint16_t issued = 0;
+static uint16_t sentToDevice = 0; //Accepted by the endpoint, the rest waits in the host controller
+static uint16_t received = 0;
+static uint16_t nextExpected = 0;
+static uint16_t misordered = 0;
+static uint32_t naks = 0;
+static Latency_t latencies[16]; //By report ID
+
+static uint8_t pidEndpoint = 0;
+static uint8_t hidEndpoint = 0;
+static int32_t forces[2];
+static uint32_t failures = 0;
+
+static void check(bool condition, const char* name, const char* what)
+{
+	if (condition) return;
+	printf("FAIL %s: %s\n", name, what);
+	failures++;
+}
+
+
+///////////////// SCRIPTS ////////////////
+
+static void create(uint8_t handle, uint8_t effectType, uint32_t delay)
+{
+	Step_t* step = &script[scriptLength++];
+	memset(step, 0, sizeof(Step_t));
+	step->delay = delay;
+	step->create = true;
+	step->handle = handle;
+	CreateNewEffectReport_t report = { 5, effectType, 0 };
+	memcpy(step->report, &report, sizeof(report));
+	step->length = sizeof(report);
+}
+
+static void output(uint8_t handle, const void* report, uint8_t length, uint32_t delay)
+{
+	Step_t* step = &script[scriptLength++];
+	memset(step, 0, sizeof(Step_t));
+	step->delay = delay;
+	step->handle = handle;
+	memcpy(step->report, report, length);
+	step->length = length;
+}
+
+//What DirectInput sends for one IDirectInputEffect::Download then Start
+static void downloadAndStart(uint8_t handle, uint8_t effectType, uint32_t gap)
+{
+	create(handle, effectType, gap);
+	SetEffectReport_t effect = { 1, 0, effectType, 0xFFFF, 0, 0, 255, 0xFF, 0x03, 0, 0 };
+	output(handle, &effect, sizeof(effect), gap);
+
+	if (effectType == 1)
+	{
+		SetConstantForceReport_t constant = { 5, 0, 6000 };
+		output(handle, &constant, sizeof(constant), gap);
+	}
+	else if (effectType <= 7)
+	{
+		SetEnvelopeReport_t envelope = { 2, 0, 10000, 10000, 0, 0 };
+		output(handle, &envelope, sizeof(envelope), gap);
+		SetPeriodicReport_t periodic = { 4, 0, 5000, 0, 0, 100 };
+		output(handle, &periodic, sizeof(periodic), gap);
+	}
+	else
+	{
+		for (uint8_t axis = 0 ; axis < 2 ; axis++)
+		{
+			SetConditionReport_t condition = { 3, 0, axis, 0, 8000, 8000, 10000, 10000, 0 };
+			output(handle, &condition, sizeof(condition), gap);
+		}
+	}
+
+	EffectOperationReport_t operation = { 10, 0, 1, 1 }; //Start
+	output(handle, &operation, sizeof(operation), gap);
+}
+
+static void freeAll(uint32_t delay)
+{
+	BlockFreeReport_t report = { 11, 255 };
+	output(NO_HANDLE, &report, sizeof(report), delay);
+}
+
+
+///////////////// HOST EMULATOR ////////////////
+
+static void reportTaken(uint8_t ep, uint32_t tag)
+{
+	if (ep != pidEndpoint || tag >= issued) return;
+	if (tag != nextExpected) misordered++;
+	nextExpected = tag + 1;
+	received++;
+
+	uint32_t latency = simulatedMicros() - issueTimes[tag];
+	Latency_t* l = &latencies[issuedReports[tag][0] & 15];
+	l->count++;
+	l->latencySum += latency;
+	if (latency > l->latencyMax) l->latencyMax = latency;
+}
+
+static bool createEffect(const Step_t* step)
+{
+	if (simulatedControlOut(REQUEST_HOSTTODEVICE_CLASS_INTERFACE, HID_SET_REPORT, HID_REPORT_TYPE_FEATURE << 8 | 5, 2,
+		step->report, step->length) < 0) return false;
+
+	BlockLoadReport_t blockLoad;
+	if (simulatedControlIn(REQUEST_DEVICETOHOST_CLASS_INTERFACE, HID_GET_REPORT, HID_REPORT_TYPE_FEATURE << 8 | 6, 2,
+		&blockLoad, sizeof(blockLoad)) != sizeof(blockLoad)) return false;
+	handles[step->handle] = blockLoad.effectBlockIndex;
+	return blockLoad.reportId == 6 && blockLoad.loadStatus == 1;
+}
+
+static void issue(const Step_t* step, const char* name)
+{
+	if (step->create)
+	{
+		check(createEffect(step), name, "Create New Effect answered with a loaded Block Load");
+		return;
+	}
+	if (issued == MAX_REPORTS) return;
+	memcpy(issuedReports[issued], step->report, step->length);
+	if (step->handle != NO_HANDLE) issuedReports[issued][1] = handles[step->handle];
+	issuedLengths[issued] = step->length;
+	issueTimes[issued] = simulatedMicros();
+	issued++;
+}
+
+//Host frames, device loop and script steps, each on its own schedule over the simulated clock
+static void run(const Timing_t& timing)
+{
+	memset(latencies, 0, sizeof(latencies));
+	issued = sentToDevice = received = nextExpected = misordered = 0;
+	naks = 0;
+	uint16_t overflowBefore = HID().pidQueue.overflowCount;
+
+	uint32_t start = simulatedMicros();
+	uint32_t nextStep = start + script[0].delay;
+	uint32_t nextFrame = start;
+	uint32_t nextLoop = start;
+	uint32_t nextTick = start + timing.tickPeriod / 2;
+	uint16_t step = 0;
+	uint32_t end = 0;
+
+	for (;;)
+	{
+		bool stepsLeft = step < scriptLength;
+		if (!stepsLeft && !end && received == issued) end = simulatedMicros() + SETTLE_TIME;
+		if (simulatedMicros() - start > RUN_TIMEOUT) break;
+		uint32_t next = nextFrame;
+		if ((int32_t) (nextLoop - next) < 0) next = nextLoop;
+		if (timing.tickPeriod && (int32_t) (nextTick - next) < 0) next = nextTick;
+		if (stepsLeft && (int32_t) (nextStep - next) < 0) next = nextStep;
+		if (end && (int32_t) (next - end) >= 0) break;
+		advanceSimulatedTime(next - simulatedMicros());
+
+		if (stepsLeft && next == nextStep)
+		{
+			issue(&script[step], timing.name);
+			step++;
+			if (step < scriptLength) nextStep += script[step].delay;
+			continue; //Steps sharing a time all go before the frame
+		}
+
+		if (next == nextFrame)
+		{
+			if (sentToDevice < issued)
+			{
+				if (simulatedOut(pidEndpoint, issuedReports[sentToDevice], issuedLengths[sentToDevice], sentToDevice)) sentToDevice++;
+				else naks++;
+			}
+			uint8_t packet[USB_EP_SIZE];
+			while (simulatedIn(hidEndpoint, packet) >= 0) { }
+			nextFrame += FRAME_PERIOD;
+		}
+
+		if (next == nextLoop)
+		{
+			if (timing.tickPeriod) HID().PollReports(); //What updateForces does while the scheduler runs
+			else
+			{
+				HID().ReceiveReport();
+				HID().forceComputer.ComputeFinalForces(forces);
+			}
+			nextLoop += timing.loopPeriod;
+		}
+
+		if (timing.tickPeriod && next == nextTick)
+		{
+			HID().ApplyReports();
+			HID().forceComputer.ComputeFinalForces(forces);
+			nextTick += timing.tickPeriod;
+		}
+	}
+
+	printf("%-26s loop %5u us: %3u reports, %3u NAKed frames, %u queue overflows", timing.name, timing.loopPeriod,
+		received, naks, (uint16_t) (HID().pidQueue.overflowCount - overflowBefore));
+	for (uint8_t id = 0 ; id < 16 ; id++)
+		if (latencies[id].count)
+			printf(", id %u %u..%u us", id, (uint32_t) (latencies[id].latencySum / latencies[id].count), latencies[id].latencyMax);
+	printf("\n");
+
+	check(received == issued, timing.name, "every report reached the device");
+	check(misordered == 0, timing.name, "reports reached the device in order");
+	scriptLength = 0;
+}
+
+
+///////////////// CHECKS ////////////////
+
+static void checkEnumeration()
+{
+	typedef HidReportDescriptor<TestLayout> Descriptor;
+	static HIDSubDescriptor node(Descriptor::data, Descriptor::size, pidReportDescriptor, sizeof(pidReportDescriptor));
+	HID().AppendDescriptor(&node);
+
+	//Interface, HID class descriptor, IN then OUT endpoint
+	uint8_t configuration[64];
+	int length = simulatedConfiguration(configuration, sizeof(configuration));
+	check(length == 9 + 9 + 7 + 7, "enumeration", "interface descriptors");
+	uint16_t reportLength = configuration[9 + 7] | configuration[9 + 8] << 8;
+	check(reportLength == Descriptor::size + sizeof(pidReportDescriptor), "enumeration", "report descriptor length");
+	hidEndpoint = configuration[18 + 2] & 0x7F;
+	pidEndpoint = configuration[25 + 2];
+	check(configuration[18 + 2] & 0x80 && !(pidEndpoint & 0x80), "enumeration", "endpoint directions");
+
+	static uint8_t descriptor[2048];
+	int sent = simulatedControlIn(REQUEST_DEVICETOHOST_STANDARD_INTERFACE, GET_DESCRIPTOR, HID_REPORT_DESCRIPTOR_TYPE << 8, 2,
+		descriptor, sizeof(descriptor));
+	check(sent == reportLength && memcmp(descriptor, Descriptor::data, Descriptor::size) == 0
+		&& memcmp(descriptor + Descriptor::size, pidReportDescriptor, sizeof(pidReportDescriptor)) == 0, "enumeration", "report descriptor");
+
+	//Idle rate and protocol, as a host reads them back
+	uint8_t value = 0xFF;
+	check(simulatedControlOut(REQUEST_HOSTTODEVICE_CLASS_INTERFACE, HID_SET_IDLE, 125 << 8, 2, NULL, 0) == 0
+		&& simulatedControlIn(REQUEST_DEVICETOHOST_CLASS_INTERFACE, HID_GET_IDLE, 0, 2, &value, 1) == 1 && value == 125, "enumeration", "idle rate");
+	check(HID().IdlePeriod() == 500, "enumeration", "idle period in ms");
+	check(simulatedControlIn(REQUEST_DEVICETOHOST_CLASS_INTERFACE, HID_GET_PROTOCOL, 0, 2, &value, 1) == 1
+		&& value == HID_REPORT_PROTOCOL, "enumeration", "protocol");
+
+	PoolReport_t pool;
+	check(simulatedControlIn(REQUEST_DEVICETOHOST_CLASS_INTERFACE, HID_GET_REPORT, HID_REPORT_TYPE_FEATURE << 8 | 7, 2, &pool, sizeof(pool)) == sizeof(pool)
+		&& pool.reportId == 7 && pool.maxSimultaneousEffects == MAX_EFFECT_NUMBER, "enumeration", "pool report");
+}
+
+//Input reports: one endpoint write each, the latest one waits while both banks are full
+static void checkInputReports()
+{
+	InputReport<TestLayout> report;
+	uint8_t packet[USB_EP_SIZE];
+	uint32_t sent = HID().reportsSent;
+
+	for (uint8_t n = 0 ; n < 5 ; n++)
+	{
+		report.setWheel(n * 1000);
+		HID().PostReport(report.packet, sizeof(report.packet));
+	}
+	check(HID().reportsSent - sent == 2 && HID().reportsStalled == 3 && HID().reportsCoalesced == 2, "input", "two banks sent, the rest coalesced");
+
+	int length = simulatedIn(hidEndpoint, packet);
+	check(length == (int) sizeof(report.packet) && packet[0] == TestLayout::reportId, "input", "report ID and fields in one packet");
+	check(HID().FlushReport() && HID().reportsSent - sent == 3, "input", "pending report sent once a bank is free");
+	simulatedIn(hidEndpoint, packet);
+	length = simulatedIn(hidEndpoint, packet);
+	check(length > 0 && memcmp(packet, report.packet, length) == 0, "input", "latest state sent last");
+}
+
+//Input-only sketch: with nothing left to change, pushUpdate alone must send the report that found the endpoint busy
+static void checkStalledFinalReport()
+{
+	BasicPowerWheel<20, 1, 6, 8> wheel;
+	InputReport<TestLayout> expected;
+	uint8_t packet[USB_EP_SIZE];
+	simulatedControlOut(REQUEST_HOSTTODEVICE_CLASS_INTERFACE, HID_SET_IDLE, 0, 2, NULL, 0); //Reports on change only
+
+	for (int16_t n = 1 ; n <= 3 ; n++)
+	{
+		wheel.updateWheelAxis(n * 1000);
+		wheel.pushUpdate();
+	}
+	simulatedIn(hidEndpoint, packet);
+	simulatedIn(hidEndpoint, packet);
+	check(simulatedIn(hidEndpoint, packet) < 0, "stalled final report", "third report waits for a bank");
+
+	wheel.pushUpdate();
+	int length = simulatedIn(hidEndpoint, packet);
+	expected.setWheel(3000);
+	check(length == (int) sizeof(expected.packet) && memcmp(packet, expected.packet, length) == 0, "stalled final report", "sent by the next pushUpdate");
+}
+
+//Creates the host never reads the Block Load of: the dropped results must not keep their blocks
+static void checkUnansweredCreates()
+{
+	CreateNewEffectReport_t report = { 5, 1, 0 };
+	for (uint8_t n = 0 ; n < MAX_EFFECT_NUMBER + 2 ; n++)
+		simulatedControlOut(REQUEST_HOSTTODEVICE_CLASS_INTERFACE, HID_SET_REPORT, HID_REPORT_TYPE_FEATURE << 8 | 5, 2, &report, sizeof(report));
+
+	BlockLoadReport_t blockLoad;
+	bool loaded = true;
+	for (uint8_t n = 0 ; n < BLOCK_LOAD_QUEUE_LENGTH ; n++)
+	{
+		simulatedControlIn(REQUEST_DEVICETOHOST_CLASS_INTERFACE, HID_GET_REPORT, HID_REPORT_TYPE_FEATURE << 8 | 6, 2,
+			&blockLoad, sizeof(blockLoad));
+		loaded &= blockLoad.loadStatus == 1;
+	}
+	check(loaded, "unanswered creates", "latest creates still loaded");
+	check(blockLoad.ramPoolAvailable == MEMORY_SIZE - BLOCK_LOAD_QUEUE_LENGTH * EFFECT_SIZE, "unanswered creates", "dropped results released their blocks");
+
+	BlockFreeReport_t freeAll = { 11, 255 };
+	HID().forceComputer.castReport((uint8_t*) &freeAll, sizeof(freeAll));
+}
+
+int main()
+{
+	HID().forceComputer.clock = simulatedMicros;
+	setSimulatedOutListener(reportTaken);
+	checkEnumeration();
+	checkInputReports();
+	checkStalledFinalReport();
+	checkUnansweredCreates();
+
+	//DirectInput downloading and starting effects, the driver writing as fast as it can
+	static const uint8_t types[] = { 1, 4, 8, 9 };
+	for (uint8_t n = 0 ; n < sizeof(types) ; n++)
+		downloadAndStart(n, types[n], 100);
+	run({ "download and start", 1000, 0 });
+	check(forces[0] != 0 || forces[1] != 0, "download and start", "started effects produce a force");
+
+	//Game updating a constant force every frame at full speed, a slow loop behind it, then the main loop
+	//taking the reports off the endpoint while a 1 kHz scheduler tick applies them
+	static const Timing_t loops[] = { { "burst fast loop", 250, 0 }, { "burst slow loop", 20000, 0 }, { "burst scheduled ticks", 250, 1000 } };
+	for (uint8_t l = 0 ; l < sizeof(loops) / sizeof(Timing_t) ; l++)
+	{
+		for (int16_t n = 1 ; n <= 100 ; n++)
+		{
+			SetConstantForceReport_t constant = { 5, 0, (int16_t) (n * 100) };
+			output(0, &constant, sizeof(constant), 0);
+		}
+		run(loops[l]);
+		check(HID().forceComputer.effectTable[handles[0] - 1].periodic.magnitude == 10000, loops[l].name, "last magnitude applied");
+	}
+
+	//Block Free 255 on unplug, then a new session reuses the first block
+	freeAll(1000);
+	run({ "free all", 1000, 0 });
+	check(forces[0] == 0 && forces[1] == 0, "free all", "no force once every effect is freed");
+	downloadAndStart(0, 1, 1000);
+	run({ "new session", 1000, 0 });
+	check(handles[0] == 1, "new session", "blocks released by Block Free 255");
+
+	printf("pid host: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+/*
+  PluggableUSB.h - Host stand-in for the Arduino core USB interface, backed by SimulatedUsb
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Only what HID_ uses, with the values of the AVR core, so HPID.cpp builds unchanged
+
+#ifndef PLUGGABLEUSB_HOST_h
+#define PLUGGABLEUSB_HOST_h
+
+#include <stdint.h>
+#include "Arduino.h"
+
+#define USBCON
+
+#define REQUEST_DEVICETOHOST_CLASS_INTERFACE 0xA1
+#define REQUEST_HOSTTODEVICE_CLASS_INTERFACE 0x21
+#define REQUEST_DEVICETOHOST_STANDARD_INTERFACE 0x81
+#define GET_DESCRIPTOR 6
+
+#define USB_DEVICE_CLASS_HUMAN_INTERFACE 0x03
+#define USB_ENDPOINT_IN(addr) (lowByte((addr) | 0x80))
+#define USB_ENDPOINT_OUT(addr) (lowByte((addr) | 0x00))
+#define USB_ENDPOINT_TYPE_INTERRUPT 0x03
+#define USB_EP_SIZE 64
+
+#define EP_TYPE_INTERRUPT_IN 0xC1
+#define EP_TYPE_INTERRUPT_OUT 0xC0
+
+//Flags of USB_Send and USB_SendControl
+#define TRANSFER_PGM 0x80
+#define TRANSFER_RELEASE 0x40
+#define TRANSFER_ZERO 0x20
+
+//USB descriptors are byte-packed on every target
+#pragma pack(push, 1)
+
+typedef struct
+{
+	uint8_t bmRequestType;
+	uint8_t bRequest;
+	uint8_t wValueL;
+	uint8_t wValueH;
+	uint16_t wIndex;
+	uint16_t wLength;
+} USBSetup;
+
+typedef struct
+{
+	uint8_t len;
+	uint8_t dtype;
+	uint8_t number;
+	uint8_t alternate;
+	uint8_t numEndpoints;
+	uint8_t interfaceClass;
+	uint8_t interfaceSubClass;
+	uint8_t protocol;
+	uint8_t iInterface;
+} InterfaceDescriptor;
+
+typedef struct
+{
+	uint8_t len;
+	uint8_t dtype;
+	uint8_t addr;
+	uint8_t attr;
+	uint16_t packetSize;
+	uint8_t interval;
+} EndpointDescriptor;
+
+#pragma pack(pop)
+
+#define D_INTERFACE(_n, _numEndpoints, _class, _subClass, _protocol) \
+	{ 9, 4, _n, 0, _numEndpoints, _class, _subClass, _protocol, 0 }
+#define D_ENDPOINT(_addr, _attr, _packetSize, _interval) \
+	{ 7, 5, _addr, _attr, _packetSize, _interval }
+
+//Device side, implemented by SimulatedUsb.cpp
+int USB_SendControl(uint8_t flags, const void* d, int len);
+int USB_RecvControl(void* d, int len);
+uint8_t USB_Available(uint8_t ep);
+uint8_t USB_SendSpace(uint8_t ep);
+int USB_Send(uint8_t ep, const void* data, int len);
+int USB_Recv(uint8_t ep, void* data, int len);
+
+class PluggableUSBModule
+{
+public:
+	PluggableUSBModule(uint8_t numEps, uint8_t numIfs, uint8_t* epType) :
+		numEndpoints(numEps), numInterfaces(numIfs), endpointType(epType) { }
+
+protected:
+	virtual bool setup(USBSetup& setup) = 0;
+	virtual int getInterface(uint8_t* interfaceCount) = 0;
+	virtual int getDescriptor(USBSetup& setup) = 0;
+	virtual uint8_t getShortName(char* name) { name[0] = 'A' + pluggedInterface; return 1; }
+
+	uint8_t pluggedInterface;
+	uint8_t pluggedEndpoint;
+
+	const uint8_t numEndpoints;
+	const uint8_t numInterfaces;
+	const uint8_t* endpointType;
+
+	PluggableUSBModule* next = NULL;
+
+	friend class PluggableUSB_;
+};
+
+class PluggableUSB_
+{
+public:
+	bool plug(PluggableUSBModule* node);
+	int getInterface(uint8_t* interfaceCount);
+	int getDescriptor(USBSetup& setup);
+	bool setup(USBSetup& setup);
+
+private:
+	uint8_t lastIf = 2; //After the CDC serial interfaces and endpoints, as on a Leonardo
+	uint8_t lastEp = 4;
+	PluggableUSBModule* rootNode = NULL;
+};
+
+PluggableUSB_& PluggableUSB();
+
+#endif
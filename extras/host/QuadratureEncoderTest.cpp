@@ -0,0 +1,109 @@
+/*
+  QuadratureEncoderTest.cpp - Quadrature decoder against simulated channel sequences
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <chrono>
+#include "QuadratureEncoder.h"
+#include "SimulatedEncoder.h"
+
+#define WALK_EDGES 2000000UL
+#define SPIN_EDGES 150000L //Well past a 16-bit position
+
+static QuadratureEncoder encoder;
+static uint32_t failures = 0;
+
+//Channel levels along one line, forward is A leading B
+static const uint8_t phaseA[4] = { 0, 1, 1, 0 };
+static const uint8_t phaseB[4] = { 0, 0, 1, 1 };
+static uint8_t phase = 0;
+
+static void step(int8_t direction)
+{
+	phase = (phase + direction) & 3;
+	setSimulatedEncoderPins(phaseA[phase], phaseB[phase]);
+}
+
+static void check(bool condition, const char* what, int32_t expected, int32_t actual)
+{
+	if (condition) return;
+	printf("FAIL %s: expected %d, got %d\n", what, expected, actual);
+	failures++;
+}
+
+int main()
+{
+	//Starting mid-line is not a missed edge
+	phase = 2;
+	setSimulatedEncoderPins(phaseA[phase], phaseB[phase]);
+	bool started = encoder.begin();
+	check(started, "begin starts the interrupts", 1, started);
+	step(1);
+	check(encoder.read() == 1 && encoder.readErrors() == 0, "start mid-line", 1, encoder.read());
+
+	//Random walk with contact bounce: every edge counts, bounces cancel out
+	encoder.write(0);
+	int32_t expected = 0;
+	srand(3);
+	for (uint32_t n = 0 ; n < WALK_EDGES ; n++)
+	{
+		int8_t direction = (rand() % 5 < 3) ? 1 : -1;
+		step(direction);
+		expected += direction;
+		if (rand() % 16 == 0) //Bounce back and forth on the edge just taken
+		{
+			step(-direction);
+			step(direction);
+		}
+	}
+	check(encoder.read() == expected, "random walk", expected, encoder.read());
+	check(encoder.readErrors() == 0, "random walk errors", 0, encoder.readErrors());
+
+	//Full 32-bit position, both ways
+	encoder.write(0);
+	for (int32_t n = 0 ; n < SPIN_EDGES ; n++) step(1);
+	check(encoder.read() == SPIN_EDGES, "forward spin", SPIN_EDGES, encoder.read());
+	encoder.write(0);
+	for (int32_t n = 0 ; n < SPIN_EDGES ; n++) step(-1);
+	check(encoder.read() == -SPIN_EDGES, "backward spin", -SPIN_EDGES, encoder.read());
+
+	//Both channels changing at once: an edge was missed, the position cannot tell which way
+	int32_t before = encoder.read();
+	phase = (phase + 2) & 3;
+	setSimulatedEncoderPins(phaseA[phase], phaseB[phase]);
+	check(encoder.read() == before, "missed edge position", before, encoder.read());
+	check(encoder.readErrors() == 1, "missed edge errors", 1, encoder.readErrors());
+
+	//Not counting once stopped
+	encoder.end();
+	step(1);
+	check(encoder.read() == before, "stopped", before, encoder.read());
+
+	//Decoder cost alone, the AVR budget at 200k edges/s is 80 cycles
+	phase = 3;
+	setSimulatedEncoderPins(phaseA[phase], phaseB[phase]);
+	encoder.begin();
+	static const uint8_t sequence[4] = { 0, 2, 3, 1 }; //Forward from phase 3, as readEncoderPins gives them
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t n = 0 ; n < WALK_EDGES ; n++)
+		encoder.edge(sequence[n & 3]);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	check(encoder.read() == before + (int32_t) WALK_EDGES, "direct edges", before + WALK_EDGES, encoder.read());
+
+	printf("quadrature encoder: %.1f M edges/s decoded on the host, %u failures\n", WALK_EDGES / seconds / 1e6, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,201 @@
+/*
+  ReportTraceTest.cpp - Trace ring round trips, and replays matching the session they captured
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <vector>
+#include "ReportQueue.h"
+#include "TracePlayback.h"
+
+#define WRAP_RECORDS 200
+#define SESSION_TICKS 3000
+#define TICK_PERIOD 1000
+
+static uint32_t failures = 0;
+
+//What dump writes to, instead of Serial
+struct DumpBuffer
+{
+	std::vector<uint8_t> bytes;
+	void write(uint8_t byte) { bytes.push_back(byte); }
+};
+
+typedef struct
+{
+	uint8_t source;
+	uint8_t length;
+	uint32_t timestamp;
+	uint8_t report[PID_QUEUE_SLOT_SIZE];
+} Recorded_t;
+
+static void check(bool condition, const char* what)
+{
+	if (condition) return;
+	printf("FAIL %s\n", what);
+	failures++;
+}
+
+//A small ring wraps many times: the dump holds the newest records, whole and in order
+static void checkWrap()
+{
+	static ReportTrace<128> trace;
+	static Recorded_t recorded[WRAP_RECORDS];
+	uint32_t time = 0xFFFF0000UL; //Wraps the 32-bit clock too
+	srand(5);
+	for (uint16_t n = 0 ; n < WRAP_RECORDS ; n++)
+	{
+		Recorded_t* r = &recorded[n];
+		r->source = n % 7 == 0 ? TRACE_FEATURE : TRACE_OUTPUT;
+		r->length = 2 + rand() % (PID_QUEUE_SLOT_SIZE - 1);
+		for (uint8_t i = 0 ; i < r->length ; i++) r->report[i] = rand();
+		static const uint32_t deltas[] = { 0, 1, 127, 128, 1000, 16384, 3000000 };
+		time += deltas[rand() % 7];
+		r->timestamp = time;
+		trace.record(r->source, r->report, r->length, r->timestamp);
+	}
+	check(trace.size() <= 128, "ring stays within its size");
+
+	DumpBuffer dump;
+	trace.dump(dump);
+	TraceReader reader;
+	check(reader.begin(dump.bytes.data(), dump.bytes.size()), "dump header");
+	uint32_t kept = WRAP_RECORDS - reader.droppedRecords();
+	check(kept > 4 && kept < WRAP_RECORDS, "oldest records overwritten");
+
+	TraceRecord_t record;
+	uint32_t n = WRAP_RECORDS - kept;
+	bool same = true;
+	for ( ; reader.read(&record) ; n++)
+	{
+		const Recorded_t* r = &recorded[n];
+		same &= n < WRAP_RECORDS && record.source == r->source && record.length == r->length
+			&& record.timestamp == r->timestamp && memcmp(record.report, r->report, r->length) == 0;
+	}
+	check(same && n == WRAP_RECORDS, "records read back as recorded");
+
+	trace.enabled = false;
+	trace.record(TRACE_OUTPUT, recorded[0].report, 4, time);
+	trace.enabled = true;
+	DumpBuffer again;
+	trace.dump(again);
+	check(again.bytes == dump.bytes, "nothing recorded while disabled");
+
+	printf("wrap: %u of %u records kept in 128 bytes\n", kept, WRAP_RECORDS);
+}
+
+//Live session and its replay give the same forces tick for tick
+static uint32_t now = 0;
+static uint32_t sessionClock() { return now; }
+
+static void send(ForceComputer& live, ReportTrace<4096>& trace, const void* report, uint8_t length)
+{
+	uint8_t buffer[PID_QUEUE_SLOT_SIZE] = { 0 };
+	memcpy(buffer, report, length);
+	trace.record(TRACE_OUTPUT, buffer, length, now);
+	live.castReport(buffer, length);
+}
+
+static uint8_t create(ForceComputer& live, ReportTrace<4096>& trace, uint8_t effectType)
+{
+	CreateNewEffectReport_t report = { 5, effectType, 0 };
+	trace.record(TRACE_FEATURE, (uint8_t*) &report, sizeof(report), now);
+	live.createEffect(&report);
+	BlockLoadReport_t blockLoad;
+	live.popBlockLoad(&blockLoad);
+	return blockLoad.effectBlockIndex;
+}
+
+static void checkReplay()
+{
+	static ForceComputer live, replayed;
+	static ReportTrace<4096> trace;
+	static int32_t liveForces[SESSION_TICKS][2];
+	live.clock = replayed.clock = sessionClock;
+
+	uint8_t spring = 0, sine = 0;
+	for (uint32_t tick = 0 ; tick < SESSION_TICKS ; tick++)
+	{
+		now = tick * TICK_PERIOD;
+		if (tick == 10)
+		{
+			spring = create(live, trace, 8);
+			SetEffectReport_t effect = { 1, spring, 8, 0xFFFF, 0, 0, 255, 0xFF, 0x03, 0, 0 };
+			send(live, trace, &effect, sizeof(effect));
+			SetConditionReport_t condition = { 3, spring, 0, 0, 6000, 6000, 10000, 10000, 0 };
+			send(live, trace, &condition, sizeof(condition));
+			EffectOperationReport_t start = { 10, spring, 1, 1 };
+			send(live, trace, &start, sizeof(start));
+		}
+		if (tick == 500)
+		{
+			sine = create(live, trace, 4);
+			SetEffectReport_t effect = { 1, sine, 4, 2000, 0, 0, 200, 0xFF, 0x03, 40, 0 };
+			send(live, trace, &effect, sizeof(effect));
+			SetPeriodicReport_t periodic = { 4, sine, 7000, 0, 0, 80 };
+			send(live, trace, &periodic, sizeof(periodic));
+			EffectOperationReport_t start = { 10, sine, 1, 1 };
+			send(live, trace, &start, sizeof(start));
+		}
+		if (tick > 600 && tick < 1600 && tick % 16 == 0) //Game streaming magnitude updates
+		{
+			SetPeriodicReport_t periodic = { 4, sine, (uint16_t) (tick * 5), 0, 0, 80 };
+			send(live, trace, &periodic, sizeof(periodic));
+		}
+		if (tick == 2500)
+		{
+			BlockFreeReport_t freeAll = { 11, 255 };
+			send(live, trace, &freeAll, sizeof(freeAll));
+		}
+		live.springCurPos = (int16_t) (tick % 400) - 200;
+		live.ComputeFinalForces(liveForces[tick]);
+	}
+
+	DumpBuffer dump;
+	trace.dump(dump);
+	check(trace.droppedRecords() == 0, "session fits the trace");
+
+	//Replay, same tick schedule and condition inputs
+	TraceReader reader;
+	check(reader.begin(dump.bytes.data(), dump.bytes.size()), "session dump header");
+	TraceRecord_t record;
+	bool pending = reader.read(&record);
+	bool same = true;
+	uint32_t records = 0;
+	for (uint32_t tick = 0 ; tick < SESSION_TICKS ; tick++)
+	{
+		now = tick * TICK_PERIOD;
+		for ( ; pending && record.timestamp == now ; pending = reader.read(&record), records++)
+			applyTraceRecord(replayed, record);
+		replayed.springCurPos = (int16_t) (tick % 400) - 200;
+		int32_t forces[2];
+		replayed.ComputeFinalForces(forces);
+		same &= forces[0] == liveForces[tick][0] && forces[1] == liveForces[tick][1];
+	}
+	check(!pending, "every record replayed");
+	check(same, "replayed forces match the live session");
+	check(liveForces[1000][0] != 0, "session produces forces");
+
+	printf("replay: %u records in %u bytes\n", records, (uint32_t) dump.bytes.size());
+}
+
+int main()
+{
+	checkWrap();
+	checkReplay();
+	printf("report trace: %u failures\n", failures);
+	return failures ? 1 : 0;
+}
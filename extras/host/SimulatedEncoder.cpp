@@ -0,0 +1,47 @@
+/*
+  SimulatedEncoder.cpp - Quadrature channels driven by host tests instead of pins
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "SimulatedEncoder.h"
+#include "QuadratureEncoder.h"
+
+static uint8_t pins = 0;
+static bool enabled = false;
+
+uint8_t readEncoderPins()
+{
+	return pins;
+}
+
+bool startEncoderInterrupts()
+{
+	enabled = true;
+	return true;
+}
+
+void stopEncoderInterrupts()
+{
+	enabled = false;
+}
+
+void setSimulatedEncoderPins(uint8_t a, uint8_t b)
+{
+	uint8_t next = ((a & 1) << 1) | (b & 1);
+	if (next == pins) return;
+	pins = next;
+	if (enabled) QuadratureEncoder::pinChange(readEncoderPins());
+}
@@ -0,0 +1,26 @@
+/*
+  SimulatedEncoder.h - Quadrature channels driven by host tests instead of pins
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMULATEDENCODER_h
+#define SIMULATEDENCODER_h
+#include <stdint.h>
+
+//Sets both channels at once, raising the encoder interrupt when either one changed and interrupts are on
+void setSimulatedEncoderPins(uint8_t a, uint8_t b);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+  SimulatedTimer.cpp - Host stand-in for the force scheduler timer interrupt
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "SimulatedTimer.h"
+#include "ForceScheduler.h"
+
+static uint32_t now = 0;
+static uint32_t period = 0; //0 while stopped
+static uint32_t nextCompare = 0;
+static void (*timerIsr)(void) = NULL;
+static bool blocked = false; //Interrupts disabled, or the handler already running
+static bool pending = false;
+
+uint32_t simulatedMicros()
+{
+	return now;
+}
+
+bool startForceTimer(uint16_t rate, void (*isr)(void))
+{
+	period = 1000000UL / rate;
+	nextCompare = now + period;
+	timerIsr = isr;
+	pending = false;
+	return true;
+}
+
+void stopForceTimer()
+{
+	period = 0;
+	pending = false;
+}
+
+//Like the AVR, at least one main loop instruction runs between two handlers
+static void runPending()
+{
+	if (!pending || !period || blocked) return;
+	pending = false;
+	blocked = true;
+	timerIsr();
+	blocked = false;
+}
+
+void interrupts()
+{
+	blocked = false;
+	runPending();
+}
+
+void noInterrupts()
+{
+	blocked = true;
+}
+
+void advanceSimulatedTime(uint32_t micros, bool interruptsEnabled)
+{
+	uint32_t target = now + micros;
+	bool wasBlocked = blocked;
+	if (!interruptsEnabled) blocked = true;
+
+	for (;;)
+	{
+		runPending();
+		if (!period || (int32_t) (target - nextCompare) < 0) break;
+		now = nextCompare;
+		nextCompare += period;
+		pending = true;
+	}
+	if ((int32_t) (target - now) > 0) now = target;
+
+	blocked = wasBlocked;
+	runPending();
+}
@@ -0,0 +1,33 @@
+/*
+  SimulatedTimer.h - Host stand-in for the force scheduler timer interrupt
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMULATEDTIMER_h
+#define SIMULATEDTIMER_h
+#include <stdint.h>
+
+//Behaves like Timer1 in CTC mode: compare events keep their own pace whatever the handler does,
+//and an event raised while interrupts are disabled stays pending (only one) until they are enabled again.
+//interrupts() from the handler lets the next event nest in it, as sei() does in an AVR interrupt.
+
+uint32_t simulatedMicros(); //Simulated clock, to hand to ForceComputer::clock
+
+//Lets simulated time pass, firing the timer on every compare event on the way.
+//Called from the timer handler it stands for the handler's own work.
+void advanceSimulatedTime(uint32_t micros, bool interruptsEnabled = true);
+
+#endif
@@ -0,0 +1,251 @@
+/*
+  SimulatedUsb.cpp - Host side of the USB link, for driving HID_ without a board
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "SimulatedUsb.h"
+#include "PluggableUSB.h"
+
+#define ENDPOINT_COUNT 8
+#define BANK_COUNT 2
+
+typedef struct
+{
+	uint8_t data[USB_EP_SIZE];
+	uint8_t length;
+	uint8_t read; //OUT: bytes the device already took
+	uint32_t tag;
+} Bank_t;
+
+typedef struct
+{
+	Bank_t banks[BANK_COUNT];
+	uint8_t first; //Oldest bank
+	uint8_t used; //Released to the other side
+	Bank_t filling; //IN: written by the device, not released yet
+} Endpoint_t;
+
+static Endpoint_t endpoints[ENDPOINT_COUNT];
+static void (*outListener)(uint8_t ep, uint32_t tag) = NULL;
+
+//Data stage of the control transfer in progress
+static uint8_t* controlIn = NULL;
+static const uint8_t* controlOut = NULL;
+static uint16_t controlLength = 0;
+static uint16_t controlDone = 0;
+
+
+///////////////// DEVICE SIDE, AS IN THE CORE ////////////////
+
+static Endpoint_t* endpoint(uint8_t ep)
+{
+	return &endpoints[(ep & 0x7F) % ENDPOINT_COUNT];
+}
+
+int USB_SendControl(uint8_t flags, const void* d, int len)
+{
+	//Past wLength the core drops the data but still reports it sent
+	for (int n = 0 ; n < len && controlIn && controlDone < controlLength ; n++)
+		controlIn[controlDone++] = ((const uint8_t*) d)[n];
+	return len;
+}
+
+int USB_RecvControl(void* d, int len)
+{
+	int received = 0;
+	for ( ; received < len && controlOut && controlDone < controlLength ; received++)
+		((uint8_t*) d)[received] = controlOut[controlDone++];
+	return received;
+}
+
+uint8_t USB_Available(uint8_t ep)
+{
+	Endpoint_t* e = endpoint(ep);
+	if (!e->used) return 0;
+	Bank_t* bank = &e->banks[e->first];
+	return bank->length - bank->read;
+}
+
+int USB_Recv(uint8_t ep, void* data, int len)
+{
+	Endpoint_t* e = endpoint(ep);
+	if (!e->used) return 0;
+	Bank_t* bank = &e->banks[e->first];
+	int received = 0;
+	for ( ; received < len && bank->read < bank->length ; received++)
+		((uint8_t*) data)[received] = bank->data[bank->read++];
+
+	if (bank->read == bank->length) //Bank emptied: handed back to the host
+	{
+		e->first = (e->first + 1) % BANK_COUNT;
+		e->used--;
+		if (outListener) outListener(ep & 0x7F, bank->tag);
+	}
+	return received;
+}
+
+uint8_t USB_SendSpace(uint8_t ep)
+{
+	Endpoint_t* e = endpoint(ep);
+	if (e->used == BANK_COUNT) return 0;
+	return USB_EP_SIZE - e->filling.length;
+}
+
+static void releaseIn(Endpoint_t* e)
+{
+	e->banks[(e->first + e->used) % BANK_COUNT] = e->filling;
+	e->used++;
+	e->filling.length = 0;
+}
+
+//Never waits: with the host polling between main loop iterations, a full endpoint would never drain
+int USB_Send(uint8_t ep, const void* data, int len)
+{
+	Endpoint_t* e = endpoint(ep);
+	for (int n = 0 ; n < len ; n++)
+	{
+		if (e->used == BANK_COUNT) return -1;
+		e->filling.data[e->filling.length++] = ((const uint8_t*) data)[n];
+		if (e->filling.length == USB_EP_SIZE) releaseIn(e);
+	}
+	if ((ep & TRANSFER_RELEASE) && e->filling.length) releaseIn(e);
+	return len;
+}
+
+PluggableUSB_& PluggableUSB()
+{
+	static PluggableUSB_ obj;
+	return obj;
+}
+
+bool PluggableUSB_::plug(PluggableUSBModule* node)
+{
+	if (lastEp + node->numEndpoints > ENDPOINT_COUNT) return false;
+
+	if (!rootNode) rootNode = node;
+	else
+	{
+		PluggableUSBModule* current = rootNode;
+		while (current->next) current = current->next;
+		current->next = node;
+	}
+	node->pluggedInterface = lastIf;
+	node->pluggedEndpoint = lastEp;
+	lastIf += node->numInterfaces;
+	lastEp += node->numEndpoints;
+	return true;
+}
+
+int PluggableUSB_::getInterface(uint8_t* interfaceCount)
+{
+	int sent = 0;
+	for (PluggableUSBModule* node = rootNode ; node ; node = node->next)
+	{
+		int res = node->getInterface(interfaceCount);
+		if (res < 0) return -1;
+		sent += res;
+	}
+	return sent;
+}
+
+int PluggableUSB_::getDescriptor(USBSetup& setup)
+{
+	for (PluggableUSBModule* node = rootNode ; node ; node = node->next)
+	{
+		int ret = node->getDescriptor(setup);
+		if (ret != 0) return ret; //Handled, or failed
+	}
+	return 0;
+}
+
+bool PluggableUSB_::setup(USBSetup& setup)
+{
+	for (PluggableUSBModule* node = rootNode ; node ; node = node->next)
+		if (node->setup(setup)) return true;
+	return false;
+}
+
+
+///////////////// HOST SIDE ////////////////
+
+static int controlTransfer(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index, uint16_t length)
+{
+	USBSetup setup = { requestType, request, lowByte(value), highByte(value), index, length };
+	controlLength = length;
+	controlDone = 0;
+
+	bool handled;
+	if (requestType == REQUEST_DEVICETOHOST_STANDARD_INTERFACE && request == GET_DESCRIPTOR)
+		handled = PluggableUSB().getDescriptor(setup) > 0;
+	else
+		handled = PluggableUSB().setup(setup);
+
+	controlIn = NULL;
+	controlOut = NULL;
+	return handled ? controlDone : -1;
+}
+
+int simulatedControlIn(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index, void* data, uint16_t length)
+{
+	controlIn = (uint8_t*) data;
+	return controlTransfer(requestType, request, value, index, length);
+}
+
+int simulatedControlOut(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index, const void* data, uint16_t length)
+{
+	controlOut = (const uint8_t*) data;
+	return controlTransfer(requestType, request, value, index, length);
+}
+
+int simulatedConfiguration(void* data, uint16_t length)
+{
+	controlIn = (uint8_t*) data;
+	controlLength = length;
+	controlDone = 0;
+	uint8_t interfaceCount = 0;
+	int sent = PluggableUSB().getInterface(&interfaceCount);
+	controlIn = NULL;
+	return sent < 0 ? -1 : controlDone;
+}
+
+bool simulatedOut(uint8_t ep, const void* packet, uint8_t length, uint32_t tag)
+{
+	Endpoint_t* e = endpoint(ep);
+	if (e->used == BANK_COUNT || length > USB_EP_SIZE) return false;
+	Bank_t* bank = &e->banks[(e->first + e->used) % BANK_COUNT];
+	memcpy(bank->data, packet, length);
+	bank->length = length;
+	bank->read = 0;
+	bank->tag = tag;
+	e->used++;
+	return true;
+}
+
+void setSimulatedOutListener(void (*listener)(uint8_t ep, uint32_t tag))
+{
+	outListener = listener;
+}
+
+int simulatedIn(uint8_t ep, void* packet)
+{
+	Endpoint_t* e = endpoint(ep);
+	if (!e->used) return -1;
+	Bank_t* bank = &e->banks[e->first];
+	memcpy(packet, bank->data, bank->length);
+	e->first = (e->first + 1) % BANK_COUNT;
+	e->used--;
+	return bank->length;
+}
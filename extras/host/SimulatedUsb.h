@@ -0,0 +1,36 @@
+/*
+  SimulatedUsb.h - Host side of the USB link, for driving HID_ without a board
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMULATEDUSB_h
+#define SIMULATEDUSB_h
+#include <stdint.h>
+
+//Control transfers reach the plugged modules at once, as the core's control ISR would hand them over.
+//They return the data stage length, or -1 when the device stalled the request.
+int simulatedControlIn(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index, void* data, uint16_t length);
+int simulatedControlOut(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index, const void* data, uint16_t length);
+int simulatedConfiguration(void* data, uint16_t length); //Interface and endpoint descriptors of every module
+
+//Interrupt endpoints have two 64-byte banks each, like the AVR ones.
+//An OUT packet is refused (NAKed, the host retries next frame) while both banks hold unread data;
+//tag identifies it to the listener, called when the device has read all of it.
+bool simulatedOut(uint8_t ep, const void* packet, uint8_t length, uint32_t tag = 0);
+void setSimulatedOutListener(void (*listener)(uint8_t ep, uint32_t tag));
+int simulatedIn(uint8_t ep, void* packet); //The host polls: length of the packet released by the device, -1 when none
+
+#endif
@@ -0,0 +1,40 @@
+/*
+  TracePlayback.h - Feeds recorded PID reports to a ForceComputer as HID_ did when they were captured
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACEPLAYBACK_h
+#define TRACEPLAYBACK_h
+#include "ForceComputer.h"
+#include "ReportTrace.h"
+
+//Create New Effect is answered at once, as the host reads the Block Load right after it
+inline void applyTraceRecord(ForceComputer& forceComputer, const TraceRecord_t& record)
+{
+	uint8_t report[TRACE_MAX_LENGTH + 1] = { 0 };
+	memcpy(report, record.report, record.length);
+
+	if (record.source == TRACE_OUTPUT)
+		forceComputer.castReport(report, record.length);
+	else if (record.source == TRACE_FEATURE && report[0] == 5)
+	{
+		forceComputer.createEffect((CreateNewEffectReport_t*) report);
+		BlockLoadReport_t blockLoad;
+		forceComputer.popBlockLoad(&blockLoad);
+	}
+}
+
+#endif
@@ -0,0 +1,146 @@
+/*
+  TraceReplay.cpp - Replays a captured PID report trace into ForceComputer
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Forces are computed on the trace's own clock, so they come out the same at any speed:
+//a trace is a regression fixture (compare the hash or the -o output) as well as a benchmark workload.
+
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+#include "TracePlayback.h"
+
+#define REPLAY_RATE 1000 //Force loop in Hz of trace time
+#define REPLAY_TAIL 1000000UL //Trace microseconds computed after the last report, for effects to run out
+
+static ForceComputer forceComputer;
+static uint32_t traceNow = 0;
+
+static uint32_t traceClock()
+{
+	return traceNow;
+}
+
+static bool readFile(const char* path, std::vector<uint8_t>& data)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) return false;
+	uint8_t buffer[4096];
+	size_t length;
+	while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + length);
+	fclose(file);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	double speed = 0; //0: as fast as possible
+	uint32_t rate = REPLAY_RATE;
+	const char* forcesPath = NULL;
+	int option;
+	while ((option = getopt(argc, argv, "s:r:o:")) != -1)
+	{
+		if (option == 's') speed = atof(optarg);
+		else if (option == 'r' && atoi(optarg) > 0) rate = atoi(optarg);
+		else if (option == 'o') forcesPath = optarg;
+		else optind = argc + 1;
+	}
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, "usage: %s [-s speed, 1 for real time, 0 as fast as possible] [-r force loop Hz] [-o forces.csv] trace.bin\n", argv[0]);
+		return 2;
+	}
+
+	std::vector<uint8_t> data;
+	if (!readFile(argv[optind], data))
+	{
+		fprintf(stderr, "%s: cannot read\n", argv[optind]);
+		return 1;
+	}
+	FILE* forcesFile = forcesPath ? fopen(forcesPath, "w") : NULL;
+	forceComputer.clock = traceClock;
+
+	const uint32_t period = 1000000UL / rate;
+	uint32_t records = 0, dropped = 0, ticks = 0, dumps = 0;
+	uint32_t first = 0, last = 0, nextTick = 0;
+	uint32_t hash = 2166136261UL; //FNV-1a over every force sample
+	double applyTime = 0, computeTime = 0;
+	auto wallStart = std::chrono::steady_clock::now();
+
+	//Force ticks up to a trace time, paced against the wall clock unless running flat out
+	auto runUntil = [&](uint32_t until)
+	{
+		while ((int32_t) (until - nextTick) >= 0)
+		{
+			if (speed > 0)
+			{
+				double due = (nextTick - first) / speed / 1e6;
+				double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+				if (due > now) usleep((useconds_t) ((due - now) * 1e6));
+			}
+			traceNow = nextTick;
+			int32_t forces[2];
+			auto start = std::chrono::steady_clock::now();
+			forceComputer.ComputeFinalForces(forces);
+			computeTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			for (uint8_t axis = 0 ; axis < 2 ; axis++)
+				for (uint8_t n = 0 ; n < 4 ; n++)
+					hash = (hash ^ (uint8_t) (forces[axis] >> (8 * n))) * 16777619UL;
+			if (forcesFile) fprintf(forcesFile, "%u,%d,%d\n", nextTick - first, forces[0], forces[1]);
+			nextTick += period;
+			ticks++;
+		}
+	};
+
+	//A capture can hold several dumps back to back
+	const uint8_t* next = data.data();
+	const uint8_t* end = data.data() + data.size();
+	TraceReader reader;
+	while (next < end && reader.begin(next, end - next))
+	{
+		TraceRecord_t record;
+		while (reader.read(&record))
+		{
+			if (records == 0) first = nextTick = record.timestamp;
+			runUntil(record.timestamp);
+			traceNow = record.timestamp;
+			auto start = std::chrono::steady_clock::now();
+			applyTraceRecord(forceComputer, record);
+			applyTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			last = record.timestamp;
+			records++;
+		}
+		dropped += reader.droppedRecords();
+		next = reader.dumpEnd();
+		dumps++;
+	}
+	if (!dumps)
+	{
+		fprintf(stderr, "%s: not a PID trace\n", argv[optind]);
+		return 1;
+	}
+	runUntil(last + REPLAY_TAIL);
+	if (forcesFile) fclose(forcesFile);
+
+	printf("%u records from %u dumps (%u overwritten before the dump), %.3f s of trace, %u force ticks\n",
+		records, dumps, dropped, (last - first) / 1e6, ticks);
+	printf("forces hash %08x, %.0f ns per report, %.0f ns per tick\n",
+		hash, records ? applyTime * 1e9 / records : 0.0, ticks ? computeTime * 1e9 / ticks : 0.0);
+	return 0;
+}
@@ -0,0 +1,281 @@
+/*
+  UhidLoopback.cpp - PowerWheel as a Linux virtual HID device, driven by the kernel through /dev/uhid
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Same descriptor and report handling as HID_ on the board, with the kernel as the USB host:
+//OUTPUT reports go to castReport, Create New Effect to createEffect, and GET_REPORT 6 and 7 are
+//answered as HID_::getReport does. Needs write access to /dev/uhid (root or a udev rule).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <linux/uhid.h>
+#include "ForceComputer.h"
+#include "HidReportDescriptor.h"
+#include "PidReportDescriptor.h"
+
+//Default PowerWheel layout, as PowerWheel.h builds it
+typedef InputLayout<20, 1, 5, 8, 1> LoopbackLayout;
+typedef HidReportDescriptor<LoopbackLayout> LoopbackDescriptor;
+
+#define LOOPBACK_VENDOR 0x2341 //Arduino Leonardo, override with -d
+#define LOOPBACK_PRODUCT 0x8036
+#define LOOPBACK_RATE 1000 //Force loop in Hz
+#define STATS_PERIOD 1000000UL //Microseconds between statistics lines
+
+static ForceComputer forceComputer;
+static InputReport<LoopbackLayout> inputReport;
+static volatile sig_atomic_t stopping = 0;
+
+//Reports received since the last statistics line, and how long they waited for the force loop
+typedef struct
+{
+	uint32_t outputs;
+	uint32_t creates;
+	uint32_t featureReads;
+	uint32_t rendered;
+	uint64_t latencySum;
+	uint32_t latencyMax;
+} Stats_t;
+
+static Stats_t stats;
+
+#define PENDING_LENGTH 64
+static uint32_t pendingArrivals[PENDING_LENGTH]; //Reports applied but not yet in a computed force
+static uint8_t pendingCount = 0;
+
+
+static void stop(int)
+{
+	stopping = 1;
+}
+
+static bool writeEvent(int fd, const uhid_event& ev)
+{
+	ssize_t written = write(fd, &ev, sizeof(ev));
+	if (written == (ssize_t) sizeof(ev)) return true;
+	fprintf(stderr, "uhid write: %s\n", written < 0 ? strerror(errno) : "short write");
+	return false;
+}
+
+static bool createDevice(int fd, uint16_t vendor, uint16_t product)
+{
+	uhid_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	strcpy((char*) ev.u.create2.name, "PowerWheel uhid loopback");
+	strcpy((char*) ev.u.create2.phys, "powerwheel-loopback");
+	memcpy(ev.u.create2.rd_data, LoopbackDescriptor::data, LoopbackDescriptor::size);
+	memcpy(ev.u.create2.rd_data + LoopbackDescriptor::size, pidReportDescriptor, sizeof(pidReportDescriptor));
+	ev.u.create2.rd_size = LoopbackDescriptor::size + sizeof(pidReportDescriptor);
+	ev.u.create2.bus = BUS_USB;
+	ev.u.create2.vendor = vendor;
+	ev.u.create2.product = product;
+	return writeEvent(fd, ev);
+}
+
+static void sendInput(int fd)
+{
+	uhid_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_INPUT2;
+	ev.u.input2.size = sizeof(inputReport.packet);
+	memcpy(ev.u.input2.data, inputReport.packet, sizeof(inputReport.packet));
+	writeEvent(fd, ev);
+}
+
+
+///////////////// REPORT HANDLING ////////////////
+
+static void applyOutput(uint8_t* data, uint16_t size)
+{
+	if (size == 0) return;
+	forceComputer.castReport(data, size);
+	stats.outputs++;
+	if (pendingCount < PENDING_LENGTH) pendingArrivals[pendingCount++] = micros();
+}
+
+static void getReport(int fd, const uhid_get_report_req& request)
+{
+	uhid_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_GET_REPORT_REPLY;
+	ev.u.get_report_reply.id = request.id;
+	ev.u.get_report_reply.err = 0;
+
+	if (request.rtype == UHID_FEATURE_REPORT && request.rnum == 6)
+	{
+		//createEffect already ran for the matching SET_REPORT, so the result is ready without waiting
+		BlockLoadReport_t blockLoad;
+		forceComputer.popBlockLoad(&blockLoad);
+		memcpy(ev.u.get_report_reply.data, &blockLoad, sizeof(blockLoad));
+		ev.u.get_report_reply.size = sizeof(blockLoad);
+		stats.featureReads++;
+	}
+	else if (request.rtype == UHID_FEATURE_REPORT && request.rnum == 7)
+	{
+		PoolReport_t poolReport;
+		poolReport.reportId = request.rnum;
+		poolReport.ramPoolSize = MEMORY_SIZE;
+		poolReport.maxSimultaneousEffects = MAX_EFFECT_NUMBER;
+		poolReport.memoryManagement = 3;
+		memcpy(ev.u.get_report_reply.data, &poolReport, sizeof(poolReport));
+		ev.u.get_report_reply.size = sizeof(poolReport);
+		stats.featureReads++;
+	}
+	else if (request.rtype == UHID_INPUT_REPORT && request.rnum == LoopbackLayout::reportId)
+	{
+		memcpy(ev.u.get_report_reply.data, inputReport.packet, sizeof(inputReport.packet));
+		ev.u.get_report_reply.size = sizeof(inputReport.packet);
+	}
+	else
+		ev.u.get_report_reply.err = EIO;
+
+	writeEvent(fd, ev);
+}
+
+static void setReport(int fd, uhid_set_report_req& request)
+{
+	if (request.rtype == UHID_OUTPUT_REPORT) //hid_hw_request output reports come this way, not as UHID_OUTPUT
+		applyOutput(request.data, request.size);
+	else if (request.rtype == UHID_FEATURE_REPORT && request.rnum == 5)
+	{
+		CreateNewEffectReport_t newEffectReport = {};
+		memcpy(&newEffectReport, request.data, request.size < sizeof(newEffectReport) ? request.size : sizeof(newEffectReport));
+		forceComputer.createEffect(&newEffectReport);
+		stats.creates++;
+	}
+
+	uhid_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_SET_REPORT_REPLY;
+	ev.u.set_report_reply.id = request.id;
+	ev.u.set_report_reply.err = 0;
+	writeEvent(fd, ev);
+}
+
+static bool handleEvent(int fd)
+{
+	static uhid_event ev;
+	ssize_t length = read(fd, &ev, sizeof(ev));
+	if (length < 0) return errno == EINTR || errno == EAGAIN;
+	if (length == 0) return false;
+
+	switch (ev.type)
+	{
+		case UHID_START: printf("started\n"); break;
+		case UHID_STOP: printf("stopped\n"); break;
+		case UHID_OPEN: printf("opened\n"); sendInput(fd); break;
+		case UHID_CLOSE: printf("closed\n"); break;
+		case UHID_OUTPUT: applyOutput(ev.u.output.data, ev.u.output.size); break;
+		case UHID_GET_REPORT: getReport(fd, ev.u.get_report); break;
+		case UHID_SET_REPORT: setReport(fd, ev.u.set_report); break;
+	}
+	return true;
+}
+
+
+///////////////// FORCE LOOP ////////////////
+
+static void renderTick()
+{
+	int32_t forces[2];
+	forceComputer.ComputeFinalForces(forces);
+	uint32_t done = micros();
+
+	//Report-to-force latency on the device side: from the event being read to the first force computed with it
+	for (uint8_t n = 0 ; n < pendingCount ; n++)
+	{
+		uint32_t latency = done - pendingArrivals[n];
+		stats.latencySum += latency;
+		if (latency > stats.latencyMax) stats.latencyMax = latency;
+		stats.rendered++;
+	}
+	pendingCount = 0;
+
+	static uint32_t lastStats = done;
+	if (done - lastStats < STATS_PERIOD) return;
+	printf("%5u output/s %3u create/s %3u feature reads/s, latency mean %5.0f us max %5u us, force %6d %6d\n",
+		stats.outputs, stats.creates, stats.featureReads,
+		stats.rendered ? (double) stats.latencySum / stats.rendered : 0.0, stats.latencyMax, forces[0], forces[1]);
+	fflush(stdout);
+	memset(&stats, 0, sizeof(stats));
+	lastStats = done;
+}
+
+int main(int argc, char** argv)
+{
+	uint16_t vendor = LOOPBACK_VENDOR;
+	uint16_t product = LOOPBACK_PRODUCT;
+	uint32_t rate = LOOPBACK_RATE;
+	int option;
+	while ((option = getopt(argc, argv, "d:r:")) != -1)
+	{
+		unsigned int v, p;
+		if (option == 'd' && sscanf(optarg, "%x:%x", &v, &p) == 2) { vendor = v; product = p; }
+		else if (option == 'r' && atoi(optarg) > 0) rate = atoi(optarg);
+		else
+		{
+			fprintf(stderr, "usage: %s [-d vendor:product] [-r force loop Hz]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	int fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+	{
+		fprintf(stderr, "/dev/uhid: %s\n", strerror(errno));
+		return 1;
+	}
+	if (!createDevice(fd, vendor, product)) return 1;
+	printf("%04x:%04x, descriptor %u bytes, force loop %u Hz\n", vendor, product,
+		(unsigned) (LoopbackDescriptor::size + sizeof(pidReportDescriptor)), rate);
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	const uint32_t period = 1000000UL / rate;
+	uint32_t nextTick = micros();
+	while (!stopping)
+	{
+		int32_t wait = (int32_t) (nextTick - micros());
+		if (wait <= 0)
+		{
+			renderTick();
+			nextTick += period;
+			if ((int32_t) (micros() - nextTick) > (int32_t) period) nextTick = micros() + period; //Fell behind, do not catch up in a burst
+			continue;
+		}
+
+		pollfd pfd = { fd, POLLIN, 0 };
+		timespec timeout = { 0, (long) wait * 1000 };
+		int ready = ppoll(&pfd, 1, &timeout, NULL);
+		if (ready < 0 && errno != EINTR) break;
+		if (ready > 0 && !handleEvent(fd)) break;
+	}
+
+	uhid_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_DESTROY;
+	writeEvent(fd, ev);
+	close(fd);
+	return 0;
+}
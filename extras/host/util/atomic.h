@@ -0,0 +1,27 @@
+/*
+  util/atomic.h - avr-libc ATOMIC_BLOCK stand-in for host-native PowerWheel builds
+  Copyright (C) 2020 Colin Constans
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this library. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef ATOMIC_HOST_h
+#define ATOMIC_HOST_h
+
+//The host build has no interrupts: the block simply runs once
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type) for (uint8_t atomicOnce = 1 ; atomicOnce ; atomicOnce = 0)
+
+#endif